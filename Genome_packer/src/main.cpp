@@ -0,0 +1,132 @@
+/*
+ * Pack a FASTA file into the binary genome container the tools open
+ * without parsing (common/genome.h).
+ * Author: Yi Zhou
+*/
+#include "fasta.h"
+#include "genome.h"
+
+using namespace std;
+
+// Letters read at a time
+const size_t CHUNK = 1 << 20;
+const char BASES[] = "ACGT";
+
+// Write `bytes` at the end of `out`, advancing `offset`
+void write(FILE *out, const void *bytes, size_t size, uint64_t &offset)
+{
+    if (size > 0 && fwrite(bytes, 1, size, out) != size)
+    {
+        printf("Cannot write the container\n");
+        exit(1);
+    }
+    offset += size;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        printf("[ERROR] %s takes 2 arguments, but %d were given.\n\n"
+               "Usage: %s <fasta_file> <container_file>\n\n"
+               "This program packs the records of a FASTA file into a binary genome\n"
+               "container: bases in 2 bits, runs of other letters (N, IUPAC codes)\n"
+               "masked, and an index of the record headers. PSSM, Gibbs_sampler and\n"
+               "Needleman_Wunsch read it wherever they take a FASTA file, and read it\n"
+               "as that file, but for the masked letters, which they read as N.\n",
+               argv[0], argc - 1, argv[0]);
+        return 1;
+    }
+    // the read statistics are part of what the packer reports
+    fasta::verbose = true;
+    fasta::Reader reader(argv[1], fasta::Alphabet::letters);
+    FILE *out = fopen(argv[2], "wb");
+    if (out == nullptr)
+    {
+        printf("Cannot open file: %s\n", argv[2]);
+        exit(1);
+    }
+
+    // the header is rewritten at the end, with the offsets of what follows
+    // the bases
+    genome::Header header{};
+    memcpy(header.magic, genome::MAGIC, sizeof(genome::MAGIC));
+    header.version = genome::VERSION;
+    uint64_t offset = 0;
+    write(out, &header, sizeof(header), offset);
+
+    vector<genome::Entry> entries;
+    vector<genome::Run> runs;
+    string names, name, letters;
+    vector<unsigned char> packed;
+    size_t masked = 0;
+    while (reader.start(name))
+    {
+        // the whole description line, so that the tools name the record as
+        // they do from the FASTA file
+        const string &description = reader.description();
+        genome::Entry entry{names.size(), description.size(), 0, offset, runs.size(), 0};
+        names += description;
+        // 4 bases to a byte, the first in the low bits
+        unsigned char byte = 0;
+        while (reader.read(letters, CHUNK) > 0)
+        {
+            packed.clear();
+            for (const char c : letters)
+            {
+                const char *base = (c != '\0') ? strchr(BASES, c) : nullptr;
+                const unsigned code = (base != nullptr) ? base - BASES : 0;
+                if (base == nullptr)
+                {
+                    // extend the last run, or start one
+                    if (entry.run_num > 0 && runs.back().start + runs.back().length == entry.length)
+                    {
+                        runs.back().length++;
+                    }
+                    else
+                    {
+                        runs.push_back({entry.length, 1});
+                        entry.run_num++;
+                    }
+                    masked++;
+                }
+                byte |= code << (2 * (entry.length % 4));
+                entry.length++;
+                if (entry.length % 4 == 0)
+                {
+                    packed.push_back(byte);
+                    byte = 0;
+                }
+            }
+            write(out, packed.data(), packed.size(), offset);
+            letters.clear();
+        }
+        if (entry.length % 4 != 0)
+        {
+            write(out, &byte, 1, offset);
+        }
+        entries.push_back(entry);
+    }
+
+    // the index, runs and names, the index and runs aligned for mapping
+    const char padding[8] = {};
+    write(out, padding, (8 - offset % 8) % 8, offset);
+    header.record_num = entries.size();
+    header.index_offset = offset;
+    write(out, entries.data(), entries.size() * sizeof(genome::Entry), offset);
+    header.runs_offset = offset;
+    write(out, runs.data(), runs.size() * sizeof(genome::Run), offset);
+    header.names_offset = offset;
+    write(out, names.data(), names.size(), offset);
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1 || fclose(out) != 0)
+    {
+        printf("Cannot write the container\n");
+        exit(1);
+    }
+    reader.report();
+    printf("Packed %s into %s: %zu record%s, %zu masked base%s in %zu run%s, %.1f MB\n",
+           argv[1], argv[2], entries.size(), (entries.size() == 1) ? "" : "s",
+           masked, (masked == 1) ? "" : "s", runs.size(), (runs.size() == 1) ? "" : "s",
+           offset / 1048576.0);
+    return 0;
+}
@@ -7,6 +7,8 @@
 #include <sstream>
 #include <string>
 #include <vector>
+
+#include "fasta.h"
 using namespace std;
 
 const static double PSEUDOCOUNT = 0.125;
@@ -16,6 +18,18 @@ using Matrix = vector<vector<T>>;
 
 namespace infiles {
 inline Matrix<string> read_fasta(const string &input_file) {
+    if (genome::is_container(input_file)) {
+        // a packed genome (common/genome.h): its records are read as they
+        // are stored, named by their whole FASTA header line
+        fasta::Reader reader(input_file, fasta::Alphabet::letters);
+        Matrix<string> ans;
+        vector<string> seq(2);
+        while (reader.next(seq[0], seq[1])) {
+            seq[0] = ">" + reader.description();
+            ans.emplace_back(seq);
+        }
+        return ans;
+    }
     std::ifstream fin(input_file);
     std::stringstream buffer;
     if (fin.is_open()) {
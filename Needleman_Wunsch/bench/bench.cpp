@@ -0,0 +1,367 @@
+/*
+ * Throughput benchmark of the Needleman-Wunsch kernels.
+ * Built by `make bench` from the sources of src/ without main.cpp.
+*/
+#include "nw.h"
+#include <omp.h>
+#include <random>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h> // malloc_trim
+#endif
+
+using namespace std;
+
+namespace
+{
+const float MATCH = 1, MISMATCH = -1, GAP = -2;
+const size_t SYNTHETIC_LENGTHS[] = {1000, 10000, 100000, 1000000};
+const char *const DATA_PAIRS[][2] = {{"Test01", "Test02"},
+                                     {"News1", "News2"},
+                                     {"RpoB-E.coli", "RpoB-B.subtilis"},
+                                     {"HIV1a", "HIV1b"}};
+
+struct Pair
+{
+    string name, seq1, seq2;
+};
+
+struct Result
+{
+    string pair, variant;
+    size_t length1, length2;
+    int threads;
+    double cells, fill_seconds, traceback_seconds; // traceback < 0: not timed apart
+    double peak_rss_mb;
+    float score;
+};
+
+// The peak resident set size is reset before each run (Linux keeps it in
+// VmHWM, which writing 5 to clear_refs resets), so each run reports its own
+// peak. Elsewhere it is the peak of the whole process so far. The heap is
+// trimmed first: glibc keeps freed blocks resident, and they would count
+// towards every later run.
+void reset_peak_rss()
+{
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (f)
+    {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+double peak_rss_mb()
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f)
+    {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), f))
+        {
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+            {
+                break;
+            }
+        }
+        fclose(f);
+        if (kb >= 0)
+        {
+            return kb / 1024.0;
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// A random sequence, and a copy of it with 10% substitutions and 2% each of
+// insertions and deletions
+Pair synthetic(size_t length, bool mutated, mt19937_64 &rng)
+{
+    const char dna[] = "ACGT";
+    uniform_int_distribution<int> base(0, 3), percent(0, 99);
+    Pair pair{(mutated ? "mutated-" : "random-") + to_string(length), "", ""};
+    for (size_t k = 0; k < length; k++)
+    {
+        pair.seq1 += dna[base(rng)];
+    }
+    if (!mutated)
+    {
+        for (size_t k = 0; k < length; k++)
+        {
+            pair.seq2 += dna[base(rng)];
+        }
+        return pair;
+    }
+    for (char c : pair.seq1)
+    {
+        const int r = percent(rng);
+        if (r < 2)
+        {
+            continue;
+        }
+        pair.seq2 += (r < 12) ? dna[base(rng)] : c;
+        if (r >= 98)
+        {
+            pair.seq2 += dna[base(rng)];
+        }
+    }
+    return pair;
+}
+
+// Cells of the band that banded() filled last
+double band_cells(size_t nrow, size_t ncol, size_t width)
+{
+    const long diff = static_cast<long>(ncol) - static_cast<long>(nrow),
+               lo = min(0L, diff) - static_cast<long>(width), hi = max(0L, diff) + static_cast<long>(width);
+    double cells = 0;
+    for (long i = 1; i <= static_cast<long>(nrow); i++)
+    {
+        const long first = max(1L, i + lo), last = min(static_cast<long>(ncol), i + hi);
+        cells += (last >= first) ? last - first + 1 : 0;
+    }
+    return cells;
+}
+
+// Run one variant on one pair. Returns false if it was skipped.
+bool run(const string &variant, const Pair &pair, int threads, double max_matrix_mb, Result &result)
+{
+    const string &seq1 = pair.seq1, &seq2 = pair.seq2;
+    const size_t nrow = seq1.length(), ncol = seq2.length();
+    const nw::Scoring sc{MATCH, MISMATCH, GAP, 0};
+    const nw::Lanes lanes = nw::integer_lanes(sc, nrow, ncol);
+    result = Result{pair.name, variant, nrow, ncol, 1,
+                    static_cast<double>(nrow) * ncol, 0, -1, 0, 0};
+    reset_peak_rss();
+    double start = omp_get_wtime();
+    if (variant == "scalar")
+    {
+        vector<float> row;
+        nw::last_row(seq1, seq2, sc, row);
+        result.score = row.back();
+    }
+    else if (variant == "simd")
+    {
+        result.score = nw::score_only(seq1, seq2, sc, lanes);
+    }
+    else if (variant == "tiled")
+    {
+        vector<float> row;
+        nw::tiled_last_row(seq1, seq2, sc, lanes, threads, row);
+        result.score = row.back();
+        result.threads = threads;
+    }
+    else if (variant == "myers")
+    {
+        // 0/-1/-1 scores the same cells as edit distance
+        const nw::Scoring unit{0, -1, -1, 0};
+        result.score = nw::edit_score(seq1, seq2, unit);
+    }
+    else if (variant == "full")
+    {
+        // traceback matrix with 2 bits per cell
+        if (result.cells / 4 / (1 << 20) > max_matrix_mb)
+        {
+            return false;
+        }
+        TraceMatrix trace(nrow, ncol, nw::simd_lanes(lanes));
+        result.score = nw::fill_antidiagonal(lanes, seq1, seq2, sc, &trace);
+        result.fill_seconds = omp_get_wtime() - start;
+        start = omp_get_wtime();
+        nw::Cigar cigar;
+        nw::traceback(trace, nullptr, seq1, seq2, cigar);
+        result.traceback_seconds = omp_get_wtime() - start;
+    }
+    else if (variant == "banded")
+    {
+        // the traceback is part of every round of widening the band
+        size_t width = 64;
+        nw::Cigar cigar;
+        result.score = nw::banded(seq1, seq2, sc, lanes, width, cigar);
+        result.cells = band_cells(nrow, ncol, width);
+    }
+    else if (variant == "hirschberg")
+    {
+        nw::Cigar cigar;
+        result.score = nw::hirschberg(seq1, seq2, sc, cigar, lanes, threads);
+        result.threads = threads;
+    }
+    if (result.traceback_seconds < 0)
+    {
+        result.fill_seconds = omp_get_wtime() - start;
+    }
+    result.peak_rss_mb = peak_rss_mb();
+    return true;
+}
+
+void write_json(FILE *fout, const vector<Result> &results)
+{
+    fprintf(fout, "[\n");
+    for (size_t k = 0; k < results.size(); k++)
+    {
+        const Result &r = results[k];
+        fprintf(fout,
+                "  {\"pair\": \"%s\", \"variant\": \"%s\", \"length1\": %zu, \"length2\": %zu, "
+                "\"threads\": %d, \"cells\": %.0f, \"fill_seconds\": %.6f, ",
+                r.pair.c_str(), r.variant.c_str(), r.length1, r.length2, r.threads, r.cells,
+                r.fill_seconds);
+        if (r.traceback_seconds < 0)
+        {
+            fprintf(fout, "\"traceback_seconds\": null, ");
+        }
+        else
+        {
+            fprintf(fout, "\"traceback_seconds\": %.6f, ", r.traceback_seconds);
+        }
+        fprintf(fout, "\"gcups\": %.4f, \"peak_rss_mb\": %.1f, \"score\": %g}%s\n",
+                r.cells / r.fill_seconds / 1e9, r.peak_rss_mb, r.score,
+                (k + 1 < results.size()) ? "," : "");
+    }
+    fprintf(fout, "]\n");
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    string data_dir = "data", json_file;
+    vector<string> variants{"scalar", "simd", "tiled", "myers", "full", "banded", "hirschberg"};
+    double max_seconds = 10, max_matrix_mb = 1024;
+    int threads = omp_get_max_threads();
+    bool bad_option = false;
+    for (int k = 1; k < argc; k++)
+    {
+        const string opt = argv[k];
+        if (opt.rfind("--data=", 0) == 0)
+        {
+            data_dir = opt.substr(7);
+        }
+        else if (opt.rfind("--json=", 0) == 0)
+        {
+            json_file = opt.substr(7);
+        }
+        else if (opt.rfind("--variants=", 0) == 0)
+        {
+            variants.clear();
+            stringstream list(opt.substr(11));
+            string v;
+            while (getline(list, v, ','))
+            {
+                variants.push_back(v);
+                bad_option = bad_option || (v != "scalar" && v != "simd" && v != "tiled" &&
+                                            v != "myers" && v != "full" && v != "banded" &&
+                                            v != "hirschberg");
+            }
+        }
+        else if (opt.rfind("--max-seconds=", 0) == 0)
+        {
+            max_seconds = stod(opt.substr(14));
+        }
+        else if (opt.rfind("--max-matrix-mb=", 0) == 0)
+        {
+            max_matrix_mb = stod(opt.substr(16));
+        }
+        else if (opt.rfind("--threads=", 0) == 0)
+        {
+            threads = stoi(opt.substr(10));
+            bad_option = bad_option || (threads < 1);
+        }
+        else
+        {
+            bad_option = true;
+        }
+    }
+    if (bad_option)
+    {
+        printf("Usage: %s [options]\n\n"
+               "Benchmark the Needleman-Wunsch kernels on the bundled data pairs and on\n"
+               "random and mutated pairs of 1 kbp to 1 Mbp (scores %g/%g/%g, linear gaps).\n"
+               "Every run reports GCUPS (cells / fill time / 1e9), its peak RSS and, for\n"
+               "the full-matrix alignment, the traceback time apart from the fill.\n\n"
+               "Options:\n"
+               "  --variants=V,...     any of scalar (float loop), simd (anti-diagonal\n"
+               "                       integer kernel), tiled (blocked, multi-threaded),\n"
+               "                       myers (bit-parallel, 0/-1/-1 scores), full (alignment\n"
+               "                       with the traceback matrix), banded (related pairs\n"
+               "                       only), hirschberg (linear space, multi-threaded);\n"
+               "                       default: all\n"
+               "  --data=DIR           directory of the bundled FASTA files (default: data)\n"
+               "  --threads=N          threads of tiled and hirschberg (default: all cores)\n"
+               "  --max-seconds=S      skip a synthetic pair once the last one of the variant,\n"
+               "                       scaled by cells, would take longer (default 10)\n"
+               "  --max-matrix-mb=N    largest traceback matrix of full (default 1024)\n"
+               "  --json=FILE          also write the results as a JSON array (- for\n"
+               "                       standard output)\n",
+               argv[0], MATCH, MISMATCH, GAP);
+        return 1;
+    }
+    vector<Pair> pairs;
+    for (const auto &names : DATA_PAIRS)
+    {
+        pairs.push_back({string(names[0]) + "/" + names[1],
+                         nw::read_fasta(data_dir + "/" + names[0] + ".fasta"),
+                         nw::read_fasta(data_dir + "/" + names[1] + ".fasta")});
+    }
+    const size_t data_pairs = pairs.size();
+    mt19937_64 rng(2024);
+    for (size_t length : SYNTHETIC_LENGTHS)
+    {
+        pairs.push_back(synthetic(length, false, rng));
+        pairs.push_back(synthetic(length, true, rng));
+    }
+
+    FILE *table = (json_file == "-") ? stderr : stdout;
+    fprintf(table, "%-28s%-12s%8s%16s%12s%12s%10s%12s\n", "Pair", "Variant", "Threads",
+            "Cells", "Fill (s)", "Trace (s)", "GCUPS", "Peak MB");
+    vector<Result> results;
+    for (const auto &variant : variants)
+    {
+        // seconds per cell of the last pair, to skip the synthetic ones that
+        // would take too long
+        double seconds_per_cell = 0;
+        for (size_t p = 0; p < pairs.size(); p++)
+        {
+            const double cells = static_cast<double>(pairs[p].seq1.length()) * pairs[p].seq2.length();
+            // the band of unrelated sequences grows to the whole matrix
+            const bool unrelated = pairs[p].name.rfind("random-", 0) == 0;
+            Result r;
+            if ((p >= data_pairs && cells * seconds_per_cell > max_seconds) ||
+                (variant == "banded" && unrelated) ||
+                !run(variant, pairs[p], threads, max_matrix_mb, r))
+            {
+                fprintf(table, "%-28s%-12s%8s\n", pairs[p].name.c_str(), variant.c_str(), "skipped");
+                continue;
+            }
+            seconds_per_cell = (r.fill_seconds + max(r.traceback_seconds, 0.0)) / cells;
+            char trace[32] = "-";
+            if (r.traceback_seconds >= 0)
+            {
+                snprintf(trace, sizeof(trace), "%.4f", r.traceback_seconds);
+            }
+            fprintf(table, "%-28s%-12s%8d%16.0f%12.4f%12s%10.3f%12.1f\n", r.pair.c_str(),
+                    r.variant.c_str(), r.threads, r.cells, r.fill_seconds, trace,
+                    r.cells / r.fill_seconds / 1e9, r.peak_rss_mb);
+            fflush(table);
+            results.push_back(r);
+        }
+    }
+    if (!json_file.empty())
+    {
+        FILE *fout = (json_file == "-") ? stdout : fopen(json_file.c_str(), "w");
+        if (fout == nullptr)
+        {
+            printf("Cannot open file: %s\n", json_file.c_str());
+            exit(1);
+        }
+        write_json(fout, results);
+        if (fout != stdout)
+        {
+            fclose(fout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "nw.h"
+#include <algorithm> // std::max, std::min, std::max_element
+#include <cmath>     // INFINITY
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// Upper bound on the score of any alignment whose path leaves `band`. To
+// reach diagonal k and come back to diagonal NCOL - NROW of the bottom-right
+// corner, a path needs at least |k| + |k - (NCOL - NROW)| gap columns, in at
+// least two gaps; the other columns are at best pairs of the highest
+// substitution score. The bound is linear in the number of gap columns, so
+// it peaks at one end of the possible range.
+double outside_bound(const nw::Scoring &sc, size_t NROW, size_t NCOL, const Band &band)
+{
+    const long diff = static_cast<long>(NCOL) - static_cast<long>(NROW),
+               total = static_cast<long>(NROW + NCOL);
+    long gaps = total + 1;
+    if (band.hi < static_cast<long>(NCOL))
+    {
+        gaps = std::min(gaps, 2 * (band.hi + 1) - diff);
+    }
+    if (band.lo > -static_cast<long>(NROW))
+    {
+        gaps = std::min(gaps, diff - 2 * (band.lo - 1));
+    }
+    if (gaps > total)
+    {
+        return -INFINITY;
+    }
+    const double best_pair = sc.matrix ? *std::max_element(sc.matrix->scores().begin(),
+                                                           sc.matrix->scores().end())
+                                       : std::max(sc.match, sc.mismatch),
+                 opens = 2 * std::min(sc.gap_open, 0.0f);
+    auto bound = [&](long q) { return (total - q) / 2.0 * best_pair + q * static_cast<double>(sc.gap) + opens; };
+    return std::max(bound(gaps), bound(total));
+}
+
+// Whether the path of the alignment, traced back from the bottom-right
+// corner, reaches a diagonal on the edge of the band that is not also the
+// edge of the matrix
+bool touches_edge(const nw::Cigar &cigar,
+                  size_t NROW, size_t NCOL, const Band &band)
+{
+    // the diagonal only moves along the gaps, so the ends of their runs are
+    // its extremes
+    long i = NROW, j = NCOL, kmin = j - i, kmax = j - i;
+    for (const auto &run : cigar)
+    {
+        i -= (run.op != 'D') ? run.length : 0;
+        j -= (run.op != 'I') ? run.length : 0;
+        kmin = std::min(kmin, j - i);
+        kmax = std::max(kmax, j - i);
+    }
+    return (kmax >= band.hi && band.hi < static_cast<long>(NCOL)) ||
+           (kmin <= band.lo && band.lo > -static_cast<long>(NROW));
+}
+} // namespace
+
+namespace nw
+{
+float banded(const string &seq1, const string &seq2,
+             const Scoring &sc, Lanes lanes, size_t &width, Cigar &cigar)
+{
+    const size_t NROW = seq1.length(), NCOL = seq2.length();
+    const long diff = static_cast<long>(NCOL) - static_cast<long>(NROW);
+    const size_t lanes_per_vector = (lanes == Lanes::none) ? 1 : simd_lanes(lanes);
+    for (;; width *= 2)
+    {
+        // the band always holds both corners, so it has a path between them
+        const Band band{std::min(0L, diff) - static_cast<long>(width),
+                        std::max(0L, diff) + static_cast<long>(width)};
+        TraceMatrix trace(NROW, NCOL, lanes_per_vector, band);
+        TraceMatrix gap_trace(sc.affine() ? NROW : 0, NCOL, lanes_per_vector, band);
+        TraceMatrix *gaps = sc.affine() ? &gap_trace : nullptr;
+        float score;
+        if (lanes == Lanes::none)
+        {
+            vector<float> row;
+            last_row(seq1, seq2, sc, row, &trace, gaps, &band);
+            score = row.back();
+        }
+        else
+        {
+            score = fill_antidiagonal(lanes, seq1, seq2, sc, &trace, gaps, &band);
+        }
+        cigar.clear();
+        traceback(trace, gaps, seq1, seq2, cigar);
+        if (band.covers(NROW, NCOL) ||
+            (!touches_edge(cigar, NROW, NCOL, band) &&
+             score >= outside_bound(sc, NROW, NCOL, band)))
+        {
+            return score;
+        }
+    }
+}
+} // namespace nw
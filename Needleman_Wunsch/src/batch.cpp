@@ -0,0 +1,316 @@
+#include "nw.h"
+#include <algorithm> // std::max, std::sort
+#include <memory>    // std::unique_ptr
+#include <mutex>     // std::mutex, std::lock_guard
+#include <omp.h>
+#include <utility>   // std::make_pair, std::swap
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// Work units [begin, end) of one thread. The owner takes them from the front
+// one at a time; a thread whose range is empty steals the back half of the
+// largest one. Aligned to a cache line so owners do not contend.
+struct alignas(64) WorkRange
+{
+    std::mutex lock;
+    size_t begin = 0, end = 0;
+};
+
+bool next_unit(WorkRange *ranges, int nthreads, int me, size_t &unit)
+{
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> guard(ranges[me].lock);
+            if (ranges[me].begin < ranges[me].end)
+            {
+                unit = ranges[me].begin++;
+                return true;
+            }
+        }
+        int victim = -1;
+        size_t largest = 0;
+        for (int t = 0; t < nthreads; t++)
+        {
+            std::lock_guard<std::mutex> guard(ranges[t].lock);
+            if (ranges[t].end - ranges[t].begin > largest)
+            {
+                largest = ranges[t].end - ranges[t].begin;
+                victim = t;
+            }
+        }
+        if (victim < 0)
+        {
+            return false;
+        }
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> guard(ranges[victim].lock);
+            end = ranges[victim].end;
+            begin = ranges[victim].begin + (end - ranges[victim].begin) / 2;
+            ranges[victim].end = begin;
+        }
+        std::lock_guard<std::mutex> guard(ranges[me].lock);
+        ranges[me].begin = begin;
+        ranges[me].end = end;
+    }
+}
+
+// Run work(unit, workspace) for units 0 to nunits - 1 on up to `threads`
+// threads, each with its own Workspace
+template <typename Work>
+void run_stealing(size_t nunits, int threads, Work work)
+{
+    std::unique_ptr<WorkRange[]> ranges(new WorkRange[threads]);
+#pragma omp parallel num_threads(threads)
+    {
+        // the ranges start as equal slices of all the units, one per thread
+        // of the team, which OpenMP may make smaller than asked for
+        const int me = omp_get_thread_num(), nthreads = omp_get_num_threads();
+#pragma omp single
+        for (int t = 0; t < nthreads; t++)
+        {
+            ranges[t].begin = nunits * t / nthreads;
+            ranges[t].end = nunits * (t + 1) / nthreads;
+        }
+        nw::Workspace ws;
+        size_t unit;
+        while (next_unit(ranges.get(), nthreads, me, unit))
+        {
+            work(unit, ws);
+        }
+    }
+}
+
+// Longest sequence of a pair aligned by the inter-sequence kernel; beyond
+// it, the anti-diagonal kernel keeps its vectors just as full on its own
+const size_t INTERSEQ_MAX_LENGTH = 1024;
+
+struct Pair
+{
+    const string *seq1, *seq2;
+    size_t index; // in the score matrix
+};
+} // namespace
+
+namespace nw
+{
+vector<float> align_batch(const vector<FastaRecord> &queries,
+                          const vector<FastaRecord> &targets,
+                          bool all_vs_all, const Scoring &sc, bool scalar,
+                          int threads, float xdrop)
+{
+    const size_t NQ = queries.size(), NT = targets.size();
+    vector<float> scores(NQ * NT);
+    // Pairs up to INTERSEQ_MAX_LENGTH are packed one per vector lane when the
+    // scoring and mode allow it, sorted by size so that the pairs sharing a
+    // vector need little padding; the longer sequence of each pair takes the
+    // rows (the score is the same). Longer pairs fill their own matrix.
+    const Lanes lanes = (scalar || sc.affine() || sc.matrix || sc.mode != Mode::global)
+                            ? Lanes::none
+                            : integer_lanes(sc, INTERSEQ_MAX_LENGTH, INTERSEQ_MAX_LENGTH);
+    vector<Pair> pairs, short_pairs, long_pairs;
+    for (size_t q = 0; q < NQ; q++)
+    {
+        for (size_t t = all_vs_all ? q : 0; t < NT; t++)
+        {
+            const string *a = &queries[q].sequence, *b = &targets[t].sequence;
+            if (a->length() < b->length())
+            {
+                std::swap(a, b);
+            }
+            pairs.push_back({a, b, q * NT + t});
+        }
+    }
+    // the X-drop screen gives -inf to the pairs it stops, which are not
+    // aligned any further
+    vector<char> stopped(pairs.size(), 0);
+    if (xdrop > 0)
+    {
+        run_stealing(pairs.size(), threads, [&](size_t unit, Workspace &ws) {
+            stopped[unit] = nw::xdrop(*pairs[unit].seq1, *pairs[unit].seq2, sc, xdrop, &ws).terminated;
+        });
+    }
+    for (size_t k = 0; k < pairs.size(); k++)
+    {
+        if (stopped[k])
+        {
+            scores[pairs[k].index] = -INFINITY;
+        }
+        else if (lanes != Lanes::none && pairs[k].seq1->length() <= INTERSEQ_MAX_LENGTH)
+        {
+            short_pairs.push_back(pairs[k]);
+        }
+        else
+        {
+            long_pairs.push_back(pairs[k]);
+        }
+    }
+    std::sort(short_pairs.begin(), short_pairs.end(), [](const Pair &x, const Pair &y) {
+        return std::make_pair(x.seq1->length(), x.seq2->length()) <
+               std::make_pair(y.seq1->length(), y.seq2->length());
+    });
+    // units 0 to npacked - 1 are vectors of short pairs, then one per long pair
+    const size_t width = (lanes == Lanes::none) ? 1 : simd_lanes(lanes),
+                 npacked = (short_pairs.size() + width - 1) / width;
+    run_stealing(npacked + long_pairs.size(), threads, [&](size_t unit, Workspace &ws) {
+        if (unit >= npacked)
+        {
+            const Pair &p = long_pairs[unit - npacked];
+            const Lanes pair_lanes = scalar ? Lanes::none
+                                            : integer_lanes(sc, p.seq1->length(), p.seq2->length());
+            scores[p.index] = score_only(*p.seq1, *p.seq2, sc, pair_lanes, &ws);
+            return;
+        }
+        const size_t first = unit * width, last = std::min(first + width, short_pairs.size());
+        vector<const string *> seq1, seq2;
+        for (size_t k = first; k < last; k++)
+        {
+            seq1.push_back(short_pairs[k].seq1);
+            seq2.push_back(short_pairs[k].seq2);
+        }
+        vector<float> result(seq1.size());
+        score_pairs(lanes, seq1, seq2, sc, result.data(), &ws);
+        for (size_t k = first; k < last; k++)
+        {
+            scores[short_pairs[k].index] = result[k - first];
+        }
+    });
+    if (all_vs_all)
+    {
+        for (size_t q = 0; q < NQ; q++)
+        {
+            for (size_t t = 0; t < q; t++)
+            {
+                scores[q * NT + t] = scores[t * NT + q];
+            }
+        }
+    }
+    return scores;
+}
+
+void write_batch_alignments(const string &output_file,
+                            const vector<FastaRecord> &queries,
+                            const vector<FastaRecord> &targets,
+                            bool all_vs_all, const Scoring &sc, bool scalar,
+                            int threads, float xdrop, double max_matrix_mb)
+{
+    const size_t NQ = queries.size(), NT = targets.size();
+    vector<std::pair<size_t, size_t>> pairs;
+    for (size_t q = 0; q < NQ; q++)
+    {
+        for (size_t t = all_vs_all ? q : 0; t < NT; t++)
+        {
+            pairs.push_back(std::make_pair(q, t));
+        }
+    }
+    // traceback bits per cell, as in main
+    auto matrix_mb = [&](size_t nrow, size_t ncol) {
+        return static_cast<double>(nrow) * ncol / 4 / (1 << 20) * (sc.affine() ? 2 : 1);
+    };
+    for (const auto &p : pairs)
+    {
+        if (sc.affine() &&
+            matrix_mb(queries[p.first].sequence.length(), targets[p.second].sequence.length()) > max_matrix_mb)
+        {
+            printf("[Error] Aligning %s and %s would need a traceback matrix over %.0f MB,\n"
+                   "and linear-space alignment only supports linear gaps. Raise --max-matrix-mb.\n",
+                   queries[p.first].name.c_str(), targets[p.second].name.c_str(), max_matrix_mb);
+            exit(1);
+        }
+    }
+    FILE *fout = output_file.empty() ? stdout : fopen(output_file.c_str(), "w");
+    if (fout == nullptr)
+    {
+        printf("Cannot open file: %s\n", output_file.c_str());
+        exit(1);
+    }
+    vector<Region> regions(pairs.size());
+    vector<Cigar> cigars(pairs.size());
+    run_stealing(pairs.size(), threads, [&](size_t unit, Workspace &ws) {
+        const string &seq1 = queries[pairs[unit].first].sequence,
+                     &seq2 = targets[pairs[unit].second].sequence;
+        if (xdrop > 0 && nw::xdrop(seq1, seq2, sc, xdrop, &ws).terminated)
+        {
+            regions[unit].score = -INFINITY;
+            return;
+        }
+        // reversed, as main aligns them, so the traceback runs forwards
+        string rev1(seq1.rbegin(), seq1.rend()), rev2(seq2.rbegin(), seq2.rend());
+        Scoring global = sc;
+        Region region{0, 0, rev1.length(), 0, rev2.length()};
+        if (sc.mode != Mode::global)
+        {
+            region = locate(rev1, rev2, sc,
+                            scalar ? Lanes::none : integer_lanes(sc, rev1.length(), rev2.length()));
+            rev1 = rev1.substr(region.begin1, region.end1 - region.begin1);
+            rev2 = rev2.substr(region.begin2, region.end2 - region.begin2);
+            global.mode = Mode::global;
+        }
+        const size_t nrow = rev1.length(), ncol = rev2.length();
+        const Lanes lanes = scalar ? Lanes::none : integer_lanes(global, nrow, ncol);
+        const float score = (matrix_mb(nrow, ncol) > max_matrix_mb)
+                                ? hirschberg(rev1, rev2, global, cigars[unit], lanes)
+                                : align_full(rev1, rev2, global, lanes, cigars[unit]);
+        regions[unit] = Region{score, seq1.length() - region.end1, seq1.length() - region.end1 + nrow,
+                               seq2.length() - region.end2, seq2.length() - region.end2 + ncol};
+    });
+    for (size_t k = 0; k < pairs.size(); k++)
+    {
+        if (regions[k].score != -INFINITY)
+        {
+            write_alignment(fout, queries[pairs[k].first].name, targets[pairs[k].second].name,
+                            regions[k], cigars[k]);
+        }
+    }
+    if (fout != stdout)
+    {
+        fclose(fout);
+    }
+}
+
+void write_score_matrix(const string &output_file, bool binary,
+                        const vector<FastaRecord> &queries,
+                        const vector<FastaRecord> &targets,
+                        const vector<float> &scores)
+{
+    FILE *fout = output_file.empty() ? stdout : fopen(output_file.c_str(), binary ? "wb" : "w");
+    if (fout == nullptr)
+    {
+        printf("Cannot open file: %s\n", output_file.c_str());
+        exit(1);
+    }
+    if (binary)
+    {
+        const uint32_t shape[2] = {static_cast<uint32_t>(queries.size()),
+                                   static_cast<uint32_t>(targets.size())};
+        fwrite("NWSM", 1, 4, fout);
+        fwrite(shape, sizeof(uint32_t), 2, fout);
+        fwrite(scores.data(), sizeof(float), scores.size(), fout);
+    }
+    else
+    {
+        for (const auto &target : targets)
+        {
+            fprintf(fout, "\t%s", target.name.c_str());
+        }
+        fprintf(fout, "\n");
+        for (size_t q = 0; q < queries.size(); q++)
+        {
+            fprintf(fout, "%s", queries[q].name.c_str());
+            for (size_t t = 0; t < targets.size(); t++)
+            {
+                fprintf(fout, "\t%g", scores[q * targets.size() + t]);
+            }
+            fprintf(fout, "\n");
+        }
+    }
+    if (fout != stdout)
+    {
+        fclose(fout);
+    }
+}
+} // namespace nw
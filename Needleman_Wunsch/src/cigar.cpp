@@ -0,0 +1,61 @@
+#include "nw.h"
+
+using std::string;
+
+namespace nw
+{
+string cigar_string(const Cigar &cigar)
+{
+    string ans;
+    char buf[16];
+    for (const auto &run : cigar)
+    {
+        snprintf(buf, sizeof(buf), "%u%c", run.length, run.op);
+        ans += buf;
+    }
+    return ans;
+}
+
+double identity(const Cigar &cigar)
+{
+    size_t matches = 0, columns = 0;
+    for (const auto &run : cigar)
+    {
+        matches += (run.op == '=') ? run.length : 0;
+        columns += run.length;
+    }
+    return (columns == 0) ? 0 : static_cast<double>(matches) / columns;
+}
+
+void render(const Cigar &cigar, const string &seq1, const string &seq2,
+            string &res1, string &res2, string &alignment)
+{
+    size_t i = seq1.length(), j = seq2.length(), columns = 0;
+    for (const auto &run : cigar)
+    {
+        columns += run.length;
+    }
+    res1.reserve(res1.length() + columns);
+    res2.reserve(res2.length() + columns);
+    alignment.reserve(alignment.length() + columns);
+    // the runs go back from the bottom-right cell, as the traceback built them
+    for (const auto &run : cigar)
+    {
+        for (uint32_t k = 0; k < run.length; k++)
+        {
+            res1 += (run.op == 'D') ? '-' : seq1[--i];
+            res2 += (run.op == 'I') ? '-' : seq2[--j];
+            alignment += (run.op == '=') ? '*' : ' ';
+        }
+    }
+}
+
+void write_alignment(FILE *fout, const string &name1, const string &name2,
+                     const Region &region, const Cigar &cigar)
+{
+    fprintf(fout, "%s\t%s\t%g\t%.4f\t%zu\t%zu\t%zu\t%zu\t%s\n",
+            name1.c_str(), name2.c_str(), region.score, identity(cigar),
+            region.begin1 + 1, region.end1, region.begin2 + 1, region.end2,
+            cigar_string(cigar).c_str());
+}
+} // namespace nw
@@ -0,0 +1,114 @@
+#include "nw.h"
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// Subproblems at or below this many cells are aligned with a full matrix
+const size_t BASE_CELLS = 1 << 16;
+
+// Bottom row of the matrix, from the bit-parallel or the tiled SIMD fill
+// when the scores allow
+void fill_row(const string &seq1, const string &seq2,
+              const nw::Scoring &sc, nw::Lanes lanes, int threads,
+              vector<float> &row)
+{
+    if (lanes == nw::Lanes::none)
+    {
+        nw::last_row(seq1, seq2, sc, row);
+    }
+    else if (nw::unit_cost(sc))
+    {
+        nw::edit_last_row(seq1, seq2, sc, row);
+    }
+    else
+    {
+        nw::tiled_last_row(seq1, seq2, sc, lanes, threads, row);
+    }
+}
+
+// Append the alignment of seq1 and seq2 in traceback order, i.e. starting
+// from the bottom-right corner, as nw::traceback does.
+void recurse(const string &seq1, const string &seq2,
+             const nw::Scoring &sc, nw::Lanes lanes, int threads,
+             nw::Cigar &cigar)
+{
+    const size_t NROW = seq1.length(), NCOL = seq2.length();
+    if (NROW < 2 || (NROW + 1) * (NCOL + 1) <= BASE_CELLS)
+    {
+        nw::align_full(seq1, seq2, sc, nw::Lanes::none, cigar);
+        return;
+    }
+    // Scores of row `mid` from the top-left corner and from the bottom-right
+    // corner; an optimal path crosses row `mid` where their sum peaks. Ties
+    // go to the rightmost column, but may still be broken differently from
+    // the full-matrix traceback (same score, different co-optimal alignment).
+    const size_t mid = NROW / 2;
+    vector<float> top, bottom;
+    fill_row(seq1.substr(0, mid), seq2,
+             sc, lanes, threads, top);
+    fill_row(string(seq1.rbegin(), seq1.rend() - mid),
+             string(seq2.rbegin(), seq2.rend()),
+             sc, lanes, threads, bottom);
+    size_t split = 0;
+    float best = top[0] + bottom[NCOL];
+    for (size_t j = 1; j <= NCOL; j++)
+    {
+        const float s = top[j] + bottom[NCOL - j];
+        if (s >= best)
+        {
+            best = s;
+            split = j;
+        }
+    }
+    recurse(seq1.substr(mid), seq2.substr(split),
+            sc, lanes, threads, cigar);
+    recurse(seq1.substr(0, mid), seq2.substr(0, split),
+            sc, lanes, threads, cigar);
+}
+
+// Score of the runs of `cigar` from `first` on, which align seq1 and seq2,
+// summed from the top-left corner one column at a time as the fill adds
+// them up along the same path
+float path_score(const string &seq1, const string &seq2,
+                 const nw::Scoring &sc, const nw::Cigar &cigar, size_t first)
+{
+    float score = 0;
+    size_t i = 0, j = 0;
+    for (size_t k = cigar.size(); k-- > first;)
+    {
+        const nw::CigarOp &run = cigar[k];
+        for (uint32_t n = 0; n < run.length; n++)
+        {
+            if (run.op == 'I' || run.op == 'D')
+            {
+                score += sc.gap;
+                (run.op == 'I') ? i++ : j++;
+            }
+            else
+            {
+                score += sc.matrix ? sc.matrix->score(seq1[i], seq2[j])
+                                   : ((seq1[i] == seq2[j]) ? sc.match : sc.mismatch);
+                i++;
+                j++;
+            }
+        }
+    }
+    return score;
+}
+} // namespace
+
+namespace nw
+{
+float hirschberg(const string &seq1, const string &seq2,
+                 const nw::Scoring &sc, Cigar &cigar,
+                 Lanes lanes, int threads)
+{
+    const size_t first = cigar.size();
+    recurse(seq1, seq2, sc, lanes, threads, cigar);
+    // the fill keeps the running sum along the optimal path, so summing the
+    // path in the same order gives the full-matrix score without refilling
+    return path_score(seq1, seq2, sc, cigar, first);
+}
+} // namespace nw
@@ -0,0 +1,98 @@
+#include "nw.h"
+#include <algorithm> // std::max, std::max_element, std::min
+#include <cmath>     // std::floor
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// Longest side of a path that can score `score` with at most `shorter`
+// residues on its shorter side. A path over h rows and w columns has at most
+// m = min(h, w) pairs, each at best the highest substitution score, and at
+// least |h - w| gap columns, each at best the gap score (with the opening if
+// it is a bonus), so max(h, w) <= m + (m * best_pair - score) / -gap. The
+// bound is linear in m, so it peaks at m = 0 or m = shorter. Gaps that cost
+// nothing leave the length unbounded.
+size_t reach(const nw::Scoring &sc, size_t shorter, float score)
+{
+    const double gap = sc.gap + std::max(sc.gap_open, 0.0f);
+    if (gap >= 0)
+    {
+        return static_cast<size_t>(-1) / 2;
+    }
+    const double best_pair = sc.matrix ? *std::max_element(sc.matrix->scores().begin(),
+                                                           sc.matrix->scores().end())
+                                       : std::max(sc.match, sc.mismatch);
+    auto longest = [&](double m) { return m + (m * best_pair - score) / -gap; };
+    const double bound = std::max(longest(0), longest(static_cast<double>(shorter)));
+    return (bound < 0) ? 0 : static_cast<size_t>(std::min(std::floor(bound), 1e18));
+}
+
+// Fill seq1 x seq2 for the cell `best` asks for. As in score_only, the
+// shorter sequence takes the dimension kept in memory: the rows of the
+// vector kernel, the columns of last_row.
+nw::Cell search(const string &seq1, const string &seq2, const nw::Scoring &sc,
+                nw::Lanes lanes, nw::Cell best, nw::Workspace *ws)
+{
+    const bool rows_shorter = seq1.length() <= seq2.length();
+    if (lanes == nw::Lanes::none)
+    {
+        best.transposed = rows_shorter;
+        vector<float> row;
+        nw::last_row(rows_shorter ? seq2 : seq1, rows_shorter ? seq1 : seq2, sc, row,
+                     nullptr, nullptr, nullptr, ws, &best);
+    }
+    else
+    {
+        best.transposed = !rows_shorter;
+        nw::fill_antidiagonal(lanes, rows_shorter ? seq1 : seq2, rows_shorter ? seq2 : seq1, sc,
+                              nullptr, nullptr, nullptr, ws, nullptr, &best);
+    }
+    return best;
+}
+} // namespace
+
+namespace nw
+{
+Cell best_end(const string &seq1, const string &seq2,
+              const Scoring &sc, Lanes lanes, Workspace *ws)
+{
+    Cell end = search(seq1, seq2, sc, lanes, Cell{sc.mode == Mode::local}, ws);
+    if (sc.mode == Mode::local && end.score < 0)
+    {
+        end.score = 0; // an empty sequence has no interior cells
+    }
+    return end;
+}
+
+Region locate(const string &seq1, const string &seq2,
+              const Scoring &sc, Lanes lanes)
+{
+    const Cell end = best_end(seq1, seq2, sc, lanes);
+    Region region{end.score, end.i, end.i, end.j, end.j};
+    // an end on the first row or column aligns nothing, and so does a local
+    // alignment that cannot score above 0
+    if (end.i == 0 || end.j == 0 || (sc.mode == Mode::local && end.score <= 0))
+    {
+        return region;
+    }
+    // The start is where the best alignment of the reversed prefixes ending
+    // at `end` ends, starting from their first cell: anywhere for a local
+    // alignment, on their last row or column for a semi-global one. A path
+    // that reaches the score is at most `limit` long on either side, so the
+    // prefixes are cut one residue past it; the row or column of a cut is not
+    // the first one of the matrix, but no cell on it reaches the score.
+    const size_t limit = reach(sc, std::min(end.i, end.j), end.score),
+                 len1 = std::min(end.i, limit + 1), len2 = std::min(end.j, limit + 1);
+    const string rev1(seq1.rend() - end.i, seq1.rend() - end.i + len1),
+        rev2(seq2.rend() - end.j, seq2.rend() - end.j + len2);
+    Scoring anchored = sc;
+    anchored.mode = Mode::global;
+    const Lanes start_lanes = (lanes == Lanes::none) ? Lanes::none : integer_lanes(anchored, len1, len2);
+    const Cell start = search(rev1, rev2, anchored, start_lanes, Cell{sc.mode == Mode::local}, nullptr);
+    region.begin1 = end.i - start.i;
+    region.begin2 = end.j - start.j;
+    return region;
+}
+} // namespace nw
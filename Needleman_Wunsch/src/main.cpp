@@ -3,120 +3,343 @@
  * Author: Yi Zhou
 */
 #include "nw.h"
+#include "fasta.h"
+#include <memory> // std::unique_ptr
+#include <omp.h>
 
 using namespace std;
 
 const unsigned PRINT_WIDTH = 60;
+const double MAX_MATRIX_MB = 4096;
 
 int main(int argc, char **argv)
 {
-    if (argc != 6)
+    string kernel = "auto";
+    double max_matrix_mb = MAX_MATRIX_MB;
+    float gap_open = 0, xdrop = 0;
+    size_t band_width = 0;
+    int threads = omp_get_max_threads();
+    string matrix_name, output_file, format = "tsv", mode = "global";
+    bool score_only = false, batch = false, bad_option = false;
+    for (int k = 6; k < argc; k++)
     {
-        printf("[Error] %s takes 5 arguments, but %d were given.\n\n"
-               "Usage: %s <seq1> <seq2> <match_score> <mismatch_score> <gap_penalty>\n\n"
+        const string opt = argv[k];
+        if (opt.rfind("--kernel=", 0) == 0)
+        {
+            kernel = opt.substr(9);
+        }
+        else if (opt.rfind("--max-matrix-mb=", 0) == 0)
+        {
+            max_matrix_mb = stod(opt.substr(16));
+        }
+        else if (opt.rfind("--gap-open=", 0) == 0)
+        {
+            gap_open = stof(opt.substr(11));
+        }
+        else if (opt.rfind("--matrix=", 0) == 0)
+        {
+            matrix_name = opt.substr(9);
+        }
+        else if (opt.rfind("--band=", 0) == 0)
+        {
+            band_width = stoul(opt.substr(7));
+            bad_option = bad_option || (band_width == 0);
+        }
+        else if (opt == "--score-only")
+        {
+            score_only = true;
+        }
+        else if (opt == "--batch")
+        {
+            batch = true;
+        }
+        else if (opt == "--verbose")
+        {
+            fasta::verbose = true;
+        }
+        else if (opt.rfind("--threads=", 0) == 0)
+        {
+            threads = stoi(opt.substr(10));
+            bad_option = bad_option || (threads < 1);
+        }
+        else if (opt.rfind("--output=", 0) == 0)
+        {
+            output_file = opt.substr(9);
+        }
+        else if (opt.rfind("--format=", 0) == 0)
+        {
+            format = opt.substr(9);
+            bad_option = bad_option || (format != "tsv" && format != "binary" && format != "cigar");
+        }
+        else if (opt.rfind("--xdrop=", 0) == 0)
+        {
+            xdrop = stof(opt.substr(8));
+            bad_option = bad_option || !(xdrop > 0);
+        }
+        else if (opt.rfind("--mode=", 0) == 0)
+        {
+            mode = opt.substr(7);
+            bad_option = bad_option || (mode != "global" && mode != "semiglobal" && mode != "local");
+        }
+        else
+        {
+            bad_option = true;
+        }
+    }
+    // OpenMP starts no more threads than its limit (OMP_THREAD_LIMIT)
+    threads = min(threads, omp_get_thread_limit());
+    if (argc < 6 || bad_option || (kernel != "auto" && kernel != "scalar") ||
+        (xdrop > 0 && mode != "global"))
+    {
+        if (argc < 6)
+        {
+            printf("[Error] %s takes 5 arguments before its options, but %d were given.\n\n", argv[0], argc - 1);
+        }
+        else
+        {
+            printf("[Error] Invalid or conflicting options.\n\n");
+        }
+        printf("Usage: %s <seq1> <seq2> <match_score> <mismatch_score> <gap_penalty> [options]\n\n"
                "This program implements the Needleman-Wunsch algorithm and\n"
                "align the two given sequences.\n"
-               "Matches and mismatches have uniform scores, whereas gaps have a linear penalty.\n",
-               argv[0], argc - 1, argv[0]);
+               "Matches and mismatches have uniform scores, whereas gaps have a linear penalty.\n\n"
+               "Options:\n"
+               "  --mode=M             global (default), semiglobal (gaps before or after either\n"
+               "                       sequence are free) or local (Smith-Waterman); the end of\n"
+               "                       the best alignment is found in linear space, then only\n"
+               "                       the part of the matrix it spans is aligned\n"
+               "  --xdrop=X            global mode: first fill only the cells reached from cells\n"
+               "                       at most X below the best score so far, and stop if none\n"
+               "                       is left (unrelated sequences); otherwise align as usual.\n"
+               "                       In batch mode the pairs it stops score -inf; it pays\n"
+               "                       off on pairs too long for the SIMD lanes\n"
+               "  --gap-open=G         a gap of length k costs G + k * gap_penalty (affine, Gotoh)\n"
+               "  --matrix=M           score residue pairs with substitution matrix M (BLOSUM62,\n"
+               "                       PAM250 or a file in NCBI format) instead of\n"
+               "                       match_score/mismatch_score\n"
+               "  --kernel=auto|scalar whole-number scores are filled by an integer SIMD kernel\n"
+               "                       (AVX2/SSE4.1, picked at runtime), or, for global scores\n"
+               "                       with mismatch = gap + match / 2 such as 0 -1 -1, by\n"
+               "                       Myers' bit-parallel edit distance (score-only and\n"
+               "                       linear-space); scalar forces the float loop\n"
+               "  --max-matrix-mb=N    align in linear space (Hirschberg) if the traceback matrix\n"
+               "                       would need more than N MB (default %.0f)\n"
+               "  --band=W             fill only a band of half-width W around the corner\n"
+               "                       diagonals, doubling it until the result provably equals\n"
+               "                       the full matrix; O(length * W) time and memory\n"
+               "  --score-only         print the final score without the alignment, keeping\n"
+               "                       only O(min(length1, length2)) cells in memory\n"
+               "  --batch              seq1 and seq2 are multi-FASTA files: score every record of\n"
+               "                       seq1 against every record of seq2 (all-vs-all if they are\n"
+               "                       the same file) and write the score matrix; with global\n"
+               "                       mode, linear gaps and match/mismatch scores, pairs up to\n"
+               "                       1024 residues are aligned one per SIMD lane\n"
+               "  --threads=N          threads for batch mode, and for --score-only and\n"
+               "                       linear-space alignment of a single pair, whose matrix is\n"
+               "                       then filled in blocks, an anti-diagonal of blocks at a\n"
+               "                       time (default: all cores)\n"
+               "  --output=FILE        batch mode output file (default: standard output)\n"
+               "  --verbose            report the records, residues and read speed of each\n"
+               "                       input file on standard error\n"
+               "  --format=tsv|binary  batch mode score matrix; binary is \"NWSM\", uint32 rows,\n"
+               "                       uint32 columns, then float32 scores row-major\n"
+               "  --format=cigar       instead of the text alignment (or, in batch mode, the\n"
+               "                       score matrix), one tab-separated record per alignment:\n"
+               "                       name1, name2, score, identity, start1, end1, start2,\n"
+               "                       end2 (from 1) and the CIGAR (=, X, I for seq1 against a\n"
+               "                       gap, D for seq2 against a gap)\n",
+               argv[0], MAX_MATRIX_MB);
         return 1;
     }
     // Read file in and parse sequence into a single string
     const float MATCH = stof(argv[3]), MISMATCH = stof(argv[4]), GAP = stof(argv[5]);
-    string seq1, seq2;
-    seq1 = nw::read_fasta(argv[1]);
-    seq2 = nw::read_fasta(argv[2]);
-
-    // convert all to upper case and remove non-alphabetic characters
-    nw::prepare_sequence(seq1);
-    nw::prepare_sequence(seq2);
+    nw::Scoring SCORING{MATCH, MISMATCH, GAP, gap_open};
+    SCORING.mode = (mode == "local")        ? nw::Mode::local
+                   : (mode == "semiglobal") ? nw::Mode::semiglobal
+                                            : nw::Mode::global;
+    unique_ptr<SubstitutionMatrix> matrix;
+    if (!matrix_name.empty())
+    {
+        matrix.reset(new SubstitutionMatrix(matrix_name));
+        SCORING.matrix = matrix.get();
+    }
+    if (batch)
+    {
+        const bool all_vs_all = string(argv[1]) == argv[2];
+        const vector<nw::FastaRecord> queries = nw::read_fasta_records(argv[1]),
+                                      targets = all_vs_all ? queries : nw::read_fasta_records(argv[2]);
+        double cells = 0;
+        for (const auto &q : queries)
+        {
+            for (const auto &t : targets)
+            {
+                cells += static_cast<double>(q.sequence.length()) * t.sequence.length();
+            }
+        }
+        if (all_vs_all)
+        {
+            cells /= 2;
+        }
+        const double start = omp_get_wtime();
+        if (format == "cigar")
+        {
+            nw::write_batch_alignments(output_file, queries, targets, all_vs_all, SCORING,
+                                       kernel == "scalar", threads, xdrop, max_matrix_mb);
+            fprintf(stderr, "Aligned %zu x %zu sequences%s with %d threads in %.3f s\n",
+                    queries.size(), targets.size(), all_vs_all ? " (all-vs-all)" : "",
+                    threads, omp_get_wtime() - start);
+            return 0;
+        }
+        const vector<float> scores = nw::align_batch(queries, targets, all_vs_all, SCORING,
+                                                     kernel == "scalar", threads, xdrop);
+        const double seconds = omp_get_wtime() - start;
+        nw::write_score_matrix(output_file, format == "binary", queries, targets, scores);
+        fprintf(stderr, "Scored %zu x %zu sequences%s with %d threads in %.3f s (%.2f GCUPS)\n",
+                queries.size(), targets.size(), all_vs_all ? " (all-vs-all)" : "",
+                threads, seconds, cells / seconds / 1e9);
+        if (xdrop > 0)
+        {
+            size_t stopped = 0;
+            for (float s : scores)
+            {
+                stopped += (s == -INFINITY);
+            }
+            fprintf(stderr, "X-drop stopped %zu of %zu scores\n", stopped, scores.size());
+        }
+        return 0;
+    }
+    // Read the sequences, upper-cased and without non-alphabetic characters
+    string seq1, seq2, name1, name2;
+    seq1 = nw::read_fasta(argv[1], &name1);
+    seq2 = nw::read_fasta(argv[2], &name2);
     const size_t NROW = seq1.length(),
                  NCOL = seq2.length();
-    printf("\nSequence 1: (%s, %zu characters):\n\n%s\n\n",
-           argv[1], NROW, seq1.c_str());
-    printf("\nSequence 2: (%s, %zu characters):\n\n%s\n\n",
-           argv[2], NCOL, seq2.c_str());
+    // with records, standard output only has the record
+    const bool records = (format == "cigar");
+    FILE *info = records ? stderr : stdout;
+    if (!records)
+    {
+        printf("\nSequence 1: (%s, %zu characters):\n\n%s\n\n",
+               argv[1], NROW, seq1.c_str());
+        printf("\nSequence 2: (%s, %zu characters):\n\n%s\n\n",
+               argv[2], NCOL, seq2.c_str());
+    }
+
+    // the X-drop screen starts from the first residues, as the batch one does
+    const nw::XDrop screen = (xdrop > 0) ? nw::xdrop(seq1, seq2, SCORING, xdrop) : nw::XDrop{};
 
     // Construct score matrix (reverse the sequence)
     nw::reverse_string(seq1);
     nw::reverse_string(seq2);
-    printf("\nScores:\n\tMatch: %.2f\n\tMismatch: %.2f\n\tGap: %.2f (linear)\n\n",
-           MATCH, MISMATCH, GAP);
-    Matrix matrix(NROW + 1, vector<float>(NCOL + 1));
-    nw::initialize_score_matrix(matrix, GAP);
-
-    // Calculate score
-    for (size_t i = 1; i <= NROW; i++)
+    fprintf(info, "\nScores:\n");
+    if (matrix)
     {
-        for (size_t j = 1; j <= NCOL; j++)
-        {
-            matrix[i][j] = nw::max_score(nw::score_left(matrix, i, j, GAP),
-                                         nw::score_top_left(matrix, i, j,
-                                                            seq1, seq2,
-                                                            MATCH, MISMATCH),
-                                         nw::score_top(matrix, i, j, GAP));
-        }
+        fprintf(info, "\tMatrix: %s\n", matrix->name().c_str());
     }
-
-    // Trace back and find the alignment
-    size_t i = NROW, j = NCOL;
-    string res1, res2, alignment;
-    const size_t result_len = NROW + NCOL;
-    res1.reserve(result_len);
-    res2.reserve(result_len);
-    alignment.reserve(result_len);
-    while (i > 0 && j > 0)
+    else
+    {
+        fprintf(info, "\tMatch: %.2f\n\tMismatch: %.2f\n", MATCH, MISMATCH);
+    }
+    if (SCORING.mode != nw::Mode::global)
+    {
+        fprintf(info, "\tMode: %s\n", mode.c_str());
+    }
+    if (SCORING.affine())
+    {
+        fprintf(info, "\tGap: %.2f open, %.2f extend (affine)\n\n", gap_open, GAP);
+    }
+    else
     {
-        if (nw::score_left(matrix, i, j, GAP) == matrix[i][j])
+        fprintf(info, "\tGap: %.2f (linear)\n\n", GAP);
+    }
+    if (xdrop > 0)
+    {
+        if (screen.terminated)
         {
-            res1 += '-';
-            res2 += seq2[j - 1];
-            alignment += ' ';
-            j--;
+            fprintf(info, "X-drop (X = %.2f) stopped the fill at anti-diagonal %zu of %zu after %zu cells;\n"
+                   "the best score was %.2f.\n\n",
+                   xdrop, screen.diagonal, NROW + NCOL, screen.cells, screen.score);
+            return 0;
         }
-        else if (nw::score_top(matrix, i, j, GAP) == matrix[i][j])
+        fprintf(info, "X-drop (X = %.2f) reached the end after %zu cells.\n\n", xdrop, screen.cells);
+    }
+    nw::Lanes lanes = (kernel == "scalar")
+                          ? nw::Lanes::none
+                          : nw::integer_lanes(SCORING, NROW, NCOL);
+    if (score_only)
+    {
+        // the tiled fill is cache-blocked and spreads over the threads; unit
+        // costs go to the bit-parallel fill of score_only instead
+        vector<float> row;
+        if (lanes != nw::Lanes::none && SCORING.mode == nw::Mode::global && !nw::unit_cost(SCORING))
         {
-            res1 += seq1[i - 1];
-            res2 += '-';
-            alignment += ' ';
-            i--;
+            nw::tiled_last_row(seq1, seq2, SCORING, lanes, threads, row);
         }
-        else
+        printf("The final alignment score is %.2f\n\n",
+               row.empty() ? nw::score_only(seq1, seq2, SCORING, lanes) : row.back());
+        return 0;
+    }
+    // A semi-global or local alignment is the global one of the part of the
+    // sequences it spans (counted from their ends here, as they are reversed)
+    size_t seq_pos1 = 1, seq_pos2 = 1;
+    if (SCORING.mode != nw::Mode::global)
+    {
+        const nw::Region region = nw::locate(seq1, seq2, SCORING, lanes);
+        seq_pos1 = NROW - region.end1 + 1;
+        seq_pos2 = NCOL - region.end2 + 1;
+        fprintf(info, "Aligned region: %zu-%zu of sequence 1, %zu-%zu of sequence 2\n\n",
+               seq_pos1, NROW - region.begin1, seq_pos2, NCOL - region.begin2);
+        seq1 = seq1.substr(region.begin1, region.end1 - region.begin1);
+        seq2 = seq2.substr(region.begin2, region.end2 - region.begin2);
+        SCORING.mode = nw::Mode::global;
+        if (lanes != nw::Lanes::none)
         {
-            res1 += seq1[i - 1];
-            res2 += seq2[j - 1];
-            if (seq1[i - 1] == seq2[j - 1])
-            {
-
-                alignment += '*';
-            }
-            else
-            {
-                alignment += ' ';
-            }
-            i--;
-            j--;
+            lanes = nw::integer_lanes(SCORING, seq1.length(), seq2.length());
         }
     }
-    // Deal with consecutive gaps at the ends of the alignment
-    while (j > 0)
+    const size_t nrow = seq1.length(), ncol = seq2.length();
+    // 2 bits of traceback direction per cell, plus 2 gap bits for affine gaps
+    const double matrix_mb = static_cast<double>(nrow) * ncol / 4 / (1 << 20) *
+                             (SCORING.affine() ? 2 : 1);
+    float final_score;
+    nw::Cigar cigar;
+    if (band_width > 0)
+    {
+        const size_t initial_width = band_width;
+        final_score = nw::banded(seq1, seq2, SCORING, lanes, band_width, cigar);
+        fprintf(info, "Banded alignment: half-width %zu (started at %zu)\n\n", band_width, initial_width);
+    }
+    else if (matrix_mb > max_matrix_mb && SCORING.affine())
     {
-        res1 += '-';
-        res2 += seq2[j - 1];
-        alignment += ' ';
-        j--;
+        printf("[Error] The traceback matrix would need %.0f MB, and linear-space\n"
+               "alignment only supports linear gaps. Raise --max-matrix-mb or use --score-only.\n",
+               matrix_mb);
+        return 1;
     }
-    while (i > 0)
+    else if (matrix_mb > max_matrix_mb)
     {
-        res1 += seq1[i - 1];
-        res2 += '-';
-        alignment += ' ';
-        i--;
+        fprintf(info, "The traceback matrix would need %.0f MB; aligning in linear space.\n\n",
+                matrix_mb);
+        final_score = nw::hirschberg(seq1, seq2, SCORING, cigar, lanes, threads);
+    }
+    else
+    {
+        // Fill the matrix, then trace back and find the alignment
+        final_score = nw::align_full(seq1, seq2, SCORING, lanes, cigar);
+    }
+    if (records)
+    {
+        const nw::Region region{final_score, seq_pos1 - 1, seq_pos1 - 1 + nrow,
+                                seq_pos2 - 1, seq_pos2 - 1 + ncol};
+        nw::write_alignment(stdout, name1, name2, region, cigar);
+        return 0;
     }
 
     // Print results
-    printf("The final alignment score is %.2f\n\n", matrix[NROW][NCOL]);
+    string res1, res2, alignment;
+    nw::render(cigar, seq1, seq2, res1, res2, alignment);
+    printf("The final alignment score is %.2f\n\n", final_score);
     const size_t print_len = res1.length();
-    size_t seq_pos1 = 1, seq_pos2 = 1;
     for (size_t i = 0; i < print_len; i += PRINT_WIDTH)
     {
         string substring1 = res1.substr(i, PRINT_WIDTH),
@@ -0,0 +1,114 @@
+#include "nw.h"
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// One column of one 64-row block of Myers' bit-vector algorithm, as
+// formulated by Hyyrö: P and M are the rows whose vertical delta is +1 and
+// -1, `eq` the rows that match the text residue, `hin` the horizontal delta
+// entering the block from above. Returns the horizontal delta leaving it at
+// row `last` (the bottom row of the block, or of the pattern).
+inline int advance_block(uint64_t &P, uint64_t &M, uint64_t eq, int hin, uint64_t last)
+{
+    const uint64_t Xv = eq | M;
+    eq |= (hin < 0) ? 1 : 0;
+    const uint64_t Xh = (((eq & P) + P) ^ P) | eq;
+    uint64_t Ph = M | ~(Xh | P), Mh = P & Xh;
+    const int hout = (Ph & last) ? 1 : (Mh & last) ? -1 : 0;
+    Ph = (Ph << 1) | ((hin > 0) ? 1 : 0);
+    Mh = (Mh << 1) | ((hin < 0) ? 1 : 0);
+    P = Mh | ~(Xv | Ph);
+    M = Ph & Xv;
+    return hout;
+}
+
+// Edit distances of the whole pattern against every prefix of the text,
+// D[m][0] to D[m][n], passed to out(j, distance) column by column. The
+// pattern is split into 64-row words; `bits` holds their state and the
+// match masks of every residue of the pattern.
+template <typename Out>
+void edit_bottom_row(const string &pattern, const string &text, vector<uint64_t> &bits, Out out)
+{
+    const size_t m = pattern.length(), words = (m + 63) / 64;
+    // residues of the pattern get codes from 1; code 0 matches no row
+    uint8_t code[256] = {0};
+    size_t ncodes = 1;
+    for (unsigned char c : pattern)
+    {
+        code[c] = code[c] ? code[c] : static_cast<uint8_t>(ncodes++);
+    }
+    bits.assign((ncodes + 2) * words, 0);
+    uint64_t *const peq = bits.data(), *const P = peq + ncodes * words, *const M = P + words;
+    for (size_t i = 0; i < m; i++)
+    {
+        peq[code[static_cast<unsigned char>(pattern[i])] * words + i / 64] |= uint64_t(1) << (i % 64);
+    }
+    // D[i][0] = i: every vertical delta of the first column is +1
+    for (size_t b = 0; b < words; b++)
+    {
+        P[b] = ~uint64_t(0);
+    }
+    const uint64_t last = uint64_t(1) << ((m + 63) % 64);
+    size_t distance = m;
+    out(0, distance);
+    for (size_t j = 0; j < text.length(); j++)
+    {
+        const uint64_t *eq = peq + code[static_cast<unsigned char>(text[j])] * words;
+        // D[0][j] = j: the first row goes up by one every column
+        int h = 1;
+        for (size_t b = 0; b + 1 < words; b++)
+        {
+            h = advance_block(P[b], M[b], eq[b], h, uint64_t(1) << 63);
+        }
+        if (words > 0)
+        {
+            h = advance_block(P[words - 1], M[words - 1], eq[words - 1], h, last);
+        }
+        distance += h;
+        out(j + 1, distance);
+    }
+}
+
+// Score of an alignment of i and j residues at edit distance d, for
+// unit_cost scores: with a = match and b = mismatch = gap + a / 2, every
+// column scores a * (residues in it) / 2 plus b - a if it is an edit
+double unit_score(const nw::Scoring &sc, size_t i, size_t j, size_t d)
+{
+    return sc.match * 0.5 * static_cast<double>(i + j) - (sc.match - sc.mismatch) * static_cast<double>(d);
+}
+} // namespace
+
+namespace nw
+{
+bool unit_cost(const Scoring &sc)
+{
+    return !sc.matrix && !sc.affine() && sc.mode == Mode::global &&
+           sc.match > sc.mismatch && sc.mismatch == sc.gap + sc.match / 2;
+}
+
+void edit_last_row(const string &seq1, const string &seq2, const Scoring &sc,
+                   vector<float> &row, Workspace *ws)
+{
+    Workspace local;
+    Workspace &w = ws ? *ws : local;
+    const size_t NROW = seq1.length();
+    row.resize(seq2.length() + 1);
+    edit_bottom_row(seq1, seq2, w.bits, [&](size_t j, size_t d) {
+        row[j] = static_cast<float>(unit_score(sc, NROW, j, d));
+    });
+}
+
+float edit_score(const string &seq1, const string &seq2, const Scoring &sc, Workspace *ws)
+{
+    Workspace local;
+    Workspace &w = ws ? *ws : local;
+    // the distance is symmetric, so the shorter sequence takes the words
+    const bool rows_shorter = seq1.length() <= seq2.length();
+    size_t distance = 0;
+    edit_bottom_row(rows_shorter ? seq1 : seq2, rows_shorter ? seq2 : seq1, w.bits,
+                    [&](size_t, size_t d) { distance = d; });
+    return static_cast<float>(unit_score(sc, seq1.length(), seq2.length(), distance));
+}
+} // namespace nw
@@ -1,26 +1,36 @@
 #include "nw.h"
+#include "fasta.h"
+#include <algorithm> // std::max, std::min
+#include <cmath>     // INFINITY
 
 using std::string;
 using std::vector;
 
 namespace nw
 {
-string read_fasta(const string &input_file)
+string read_fasta(const string &input_file, string *name)
 {
-    std::ifstream fin(input_file);
-    std::stringstream buffer;
-    string firstline;
-    if (fin.is_open())
+    fasta::Reader reader(input_file, fasta::Alphabet::letters);
+    string first, sequence;
+    reader.next(first, sequence);
+    reader.report();
+    if (name)
     {
-        getline(fin, firstline); // skip description line
-        buffer << fin.rdbuf();
+        *name = first;
     }
-    else
+    return sequence;
+}
+vector<FastaRecord> read_fasta_records(const string &input_file)
+{
+    fasta::Reader reader(input_file, fasta::Alphabet::letters);
+    vector<FastaRecord> records;
+    FastaRecord record;
+    while (reader.next(record.name, record.sequence))
     {
-        printf("Cannot open file: %s\n", input_file.c_str());
-        exit(1);
+        records.push_back(record);
     }
-    return buffer.str();
+    reader.report();
+    return records;
 }
 void strip_non_alphabetic(string &s)
 {
@@ -59,64 +69,343 @@ void prepare_sequence(string &s)
     to_upper_case(s);
     strip_non_alphabetic(s);
 }
-void initialize_score_matrix(Matrix &m, float gap_score)
+float max_score(const float a, const float b, const float c)
 {
-    m[0][0] = 0;
-    for (size_t i = 1; i < m.size(); i++)
+    float max = a;
+    if (b > max)
     {
-        m[i][0] = m[i - 1][0] + gap_score;
+        max = b;
     }
-    for (size_t j = 1; j < m[0].size(); j++)
+    if (c > max)
     {
-        m[0][j] = m[0][j - 1] + gap_score;
+        max = c;
     }
+    return max;
 }
-float score_top_left(Matrix &m, size_t i, size_t j,
-                     const string &seq1, const string &seq2,
-                     float match_score, float mismatch_score)
+size_t count_gap(const std::string &s)
 {
-    float score;
-    if (seq1[i - 1] == seq2[j - 1])
+    size_t num = 0;
+    for (auto &c : s)
+    {
+        if (c == '-')
+        {
+            num += 1;
+        }
+    }
+    return num;
+}
+} // namespace nw
+
+namespace
+{
+// Offer row i of a fill, its last one, to a search of the last row and column
+void offer_row(nw::Cell *ends, const vector<float> &row, size_t i)
+{
+    for (size_t j = 0; j < row.size(); j++)
+    {
+        ends->offer(row[j], i, j);
+    }
+}
+
+// Arguments of a row-by-row fill
+struct Rows
+{
+  const string &seq1, &seq2;
+  const nw::Scoring &sc;
+  vector<float> &row, &top;
+  const float *profile;
+  TraceMatrix *trace, *gap_trace;
+  const Band &band;
+  nw::Cell *all, *ends;
+};
+
+// Row-by-row fill, compiled once per scoring scheme: linear or affine
+// (Gotoh) gaps, uniform match/mismatch scores or a substitution matrix
+// profile, with or without the traceback matrix, clamped at 0 for local
+// alignment or not. Each case gets a loop without the tests of the others.
+template <bool AFFINE, bool MATRIX, bool TRACE, bool CLAMP>
+void fill_rows(const Rows &r)
+{
+    const string &seq1 = r.seq1, &seq2 = r.seq2;
+    const size_t NROW = seq1.length(), NCOL = seq2.length();
+    const float gap = r.sc.gap, open_gap = r.sc.gap_open + gap, NONE = -INFINITY,
+                match = r.sc.match, mismatch = r.sc.mismatch;
+    // Outside global mode the first row and column are free
+    const bool free_start = r.sc.mode != nw::Mode::global;
+    const float border_gap = free_start ? 0 : gap,
+                border_open = free_start ? 0 : (AFFINE ? open_gap : gap);
+    vector<float> &row = r.row, &top = r.top;
+    row.resize(NCOL + 1);
+    row[0] = 0;
+    for (size_t j = 1; j <= NCOL; j++)
+    {
+        row[j] = (j == 1) ? border_open : row[j - 1] + border_gap;
+    }
+    // Gotoh: `left` and `top[j]` are the best scores of alignments ending in
+    // a gap in seq1 and in seq2, respectively
+    if (AFFINE)
+    {
+        top.assign(NCOL + 1, NONE);
+    }
+    if (r.ends)
+    {
+        r.ends->offer(row[NCOL], 0, NCOL);
+    }
+    float first_column = 0;
+    for (size_t i = 1; i <= NROW; i++)
+    {
+        // Row i covers columns i + lo to i + hi. Its neighbours just outside
+        // the band (left of the first cell, above the last one) are set to
+        // NONE, so they never win; the whole matrix gives the unbanded loops.
+        const long lo = static_cast<long>(i) + r.band.lo, hi = static_cast<long>(i) + r.band.hi;
+        const size_t jlo = std::max(1L, lo), jhi = std::min(static_cast<long>(NCOL), hi);
+        const float *sub_row = MATRIX ? r.profile + r.sc.matrix->code(seq1[i - 1]) * NCOL : nullptr;
+        const char residue = seq1[i - 1];
+        float *const cells = row.data();
+        float top_left = cells[jlo - 1], left = NONE;
+        first_column = (i == 1) ? border_open : first_column + border_gap;
+        if (lo <= 0)
+        {
+            cells[0] = first_column;
+        }
+        if (static_cast<long>(jlo) == lo)
+        {
+            cells[jlo - 1] = NONE;
+        }
+        if (static_cast<long>(jhi) == hi)
+        {
+            cells[jhi] = NONE;
+            if (AFFINE)
+            {
+                top[jhi] = NONE;
+            }
+        }
+        for (size_t j = jlo; j <= jhi; j++)
+        {
+            const float sub = MATRIX ? sub_row[j - 1] : (residue == seq2[j - 1]) ? match : mismatch;
+            float up;
+            if constexpr (AFFINE)
+            {
+                const float left_extend = left + gap, top_extend = top[j] + gap;
+                left = std::max(left_extend, cells[j - 1] + open_gap);
+                top[j] = std::max(top_extend, cells[j] + open_gap);
+                up = top[j];
+                if (TRACE)
+                {
+                    r.gap_trace->set(i, j, ((left_extend == left) ? TraceMatrix::LEFT_EXTENDS : 0) |
+                                               ((top_extend == up) ? TraceMatrix::TOP_EXTENDS : 0));
+                }
+            }
+            else
+            {
+                left = cells[j - 1] + gap;
+                up = cells[j] + gap;
+            }
+            float best = nw::max_score(left, top_left + sub, up);
+            if (CLAMP)
+            {
+                best = std::max(best, 0.0f);
+            }
+            if (TRACE)
+            {
+                r.trace->set(i, j, (left == best) ? TraceMatrix::LEFT
+                                   : (up == best) ? TraceMatrix::TOP
+                                                  : TraceMatrix::DIAG);
+            }
+            if (r.all)
+            {
+                r.all->offer(best, i, j);
+            }
+            top_left = cells[j];
+            cells[j] = best;
+        }
+        if (r.ends)
+        {
+            r.ends->offer(row[NCOL], i, NCOL);
+        }
+    }
+    if (r.ends)
+    {
+        offer_row(r.ends, row, NROW);
+    }
+}
+
+// local mode clamps every cell at 0
+template <bool AFFINE, bool MATRIX>
+void select_rows(const Rows &r)
+{
+    const bool clamp = r.sc.mode == nw::Mode::local;
+    if (r.trace)
     {
-        score = m[i - 1][j - 1] + match_score;
+        clamp ? fill_rows<AFFINE, MATRIX, true, true>(r) : fill_rows<AFFINE, MATRIX, true, false>(r);
     }
     else
     {
-        score = m[i - 1][j - 1] + mismatch_score;
+        clamp ? fill_rows<AFFINE, MATRIX, false, true>(r) : fill_rows<AFFINE, MATRIX, false, false>(r);
     }
-    return score;
 }
-float score_left(Matrix &m, size_t i, size_t j, float gap_score)
+} // namespace
+
+TraceMatrix::TraceMatrix(size_t nrow, size_t ncol, size_t lanes)
+    : TraceMatrix(nrow, ncol, lanes, Band::full(nrow, ncol))
+{
+}
+
+TraceMatrix::TraceMatrix(size_t nrow, size_t ncol, size_t lanes, const Band &band)
+    : m_nrow(nrow), m_ncol(ncol), m_lanes(lanes)
 {
-    return m[i][j - 1] + gap_score;
+    const size_t ndiag = nrow + ncol + 1, group = 4 * lanes;
+    m_base.resize(ndiag);
+    m_first.resize(ndiag, 1);
+    size_t offset = 0;
+    for (size_t d = 2; d < ndiag && nrow > 0 && ncol > 0; d++)
+    {
+        const long first = std::max<long>((d > ncol) ? d - ncol : 1, band.first_row(d)),
+                   last = std::min<long>((d - 1 < nrow) ? d - 1 : nrow, band.last_row(d));
+        m_base[d] = offset;
+        m_first[d] = first;
+        const size_t cells = (last >= first) ? last - first + 1 : 0;
+        offset += (cells + group - 1) / group * lanes;
+    }
+    m_data.resize(offset);
 }
-float score_top(Matrix &m, size_t i, size_t j, float gap_score)
+
+void TraceMatrix::set(size_t i, size_t j, uint8_t direction)
 {
-    return m[i - 1][j] + gap_score;
+    const size_t d = i + j, o = i - first_row(d), group = 4 * m_lanes;
+    const size_t byte = m_base[d] + o / group * m_lanes + o % m_lanes;
+    m_data[byte] |= direction << (2 * (o % group / m_lanes));
 }
-float max_score(const float a, const float b, const float c)
+
+uint8_t TraceMatrix::operator()(size_t i, size_t j) const
 {
-    float max = a;
-    if (b > max)
+    const size_t d = i + j, o = i - first_row(d), group = 4 * m_lanes;
+    const size_t byte = m_base[d] + o / group * m_lanes + o % m_lanes;
+    return (m_data[byte] >> (2 * (o % group / m_lanes))) & 3;
+}
+
+namespace nw
+{
+void last_row(const string &seq1, const string &seq2,
+              const Scoring &sc, vector<float> &row,
+              TraceMatrix *trace, TraceMatrix *gap_trace,
+              const Band *band, Workspace *ws, Cell *best_cell)
+{
+    // The search for the best cell looks at every cell, or at the last
+    // column after each row and at the last row at the end.
+    Cell *const all = (best_cell && best_cell->anywhere) ? best_cell : nullptr,
+                *const ends = (best_cell && !best_cell->anywhere) ? best_cell : nullptr;
+    const Band b = band ? *band : Band::full(seq1.length(), seq2.length());
+    Workspace local;
+    Workspace &w = ws ? *ws : local;
+    // with a substitution matrix, row i of the matrix reads its scores from
+    // the profile row of seq1[i - 1] instead of comparing residues
+    if (sc.matrix)
     {
-        max = b;
+        sc.matrix->profile<float>(seq2, false, 0, w.profile);
     }
-    if (c > max)
+    const Rows rows{seq1, seq2, sc, row, w.gaps, w.profile.data(), trace, gap_trace, b, all, ends};
+    if (sc.affine())
     {
-        max = c;
+        sc.matrix ? select_rows<true, true>(rows) : select_rows<true, false>(rows);
+    }
+    else
+    {
+        sc.matrix ? select_rows<false, true>(rows) : select_rows<false, false>(rows);
     }
-    return max;
 }
-size_t count_gap(const std::string &s)
+float score_only(const string &seq1, const string &seq2,
+                 const Scoring &sc, Lanes lanes, Workspace *ws)
 {
-    size_t num = 0;
-    for (auto &c : s)
+    if (sc.mode != Mode::global)
     {
-        if (c == '-')
+        return best_end(seq1, seq2, sc, lanes, ws).score;
+    }
+    // the bit-parallel fill goes with the vector kernels (not --kernel=scalar)
+    if (lanes != Lanes::none && unit_cost(sc))
+    {
+        return edit_score(seq1, seq2, sc, ws);
+    }
+    // The matrix of seq2 against seq1 is the transpose, with every cell
+    // computed from the same values, so the shorter sequence can always take
+    // the dimension that is kept in memory.
+    const bool rows_shorter = seq1.length() <= seq2.length();
+    if (lanes == Lanes::none)
+    {
+        Workspace local;
+        Workspace &w = ws ? *ws : local;
+        last_row(rows_shorter ? seq2 : seq1, rows_shorter ? seq1 : seq2, sc, w.row,
+                 nullptr, nullptr, nullptr, &w);
+        return w.row.back();
+    }
+    return fill_antidiagonal(lanes, rows_shorter ? seq1 : seq2,
+                             rows_shorter ? seq2 : seq1, sc, nullptr, nullptr, nullptr, ws);
+}
+void traceback(const TraceMatrix &trace, const TraceMatrix *gap_trace,
+               const string &seq1, const string &seq2, Cigar &cigar)
+{
+    size_t i = seq1.length(), j = seq2.length();
+    // inside an affine gap, keep moving the same way until it was opened
+    uint8_t state = TraceMatrix::DIAG;
+    while (i > 0 && j > 0)
+    {
+        const uint8_t direction = (state == TraceMatrix::DIAG) ? trace(i, j) : state;
+        switch (direction)
         {
-            num += 1;
+        case TraceMatrix::LEFT:
+            state = (gap_trace && ((*gap_trace)(i, j) & TraceMatrix::LEFT_EXTENDS))
+                        ? TraceMatrix::LEFT
+                        : TraceMatrix::DIAG;
+            add_op(cigar, 'D');
+            j--;
+            break;
+        case TraceMatrix::TOP:
+            state = (gap_trace && ((*gap_trace)(i, j) & TraceMatrix::TOP_EXTENDS))
+                        ? TraceMatrix::TOP
+                        : TraceMatrix::DIAG;
+            add_op(cigar, 'I');
+            i--;
+            break;
+
+        default:
+            add_op(cigar, (seq1[i - 1] == seq2[j - 1]) ? '=' : 'X');
+            i--;
+            j--;
+            break;
         }
     }
-    return num;
+    // Deal with consecutive gaps at the ends of the alignment
+    if (j > 0)
+    {
+        add_op(cigar, 'D');
+        cigar.back().length += j - 1;
+    }
+    if (i > 0)
+    {
+        add_op(cigar, 'I');
+        cigar.back().length += i - 1;
+    }
+}
+float align_full(const string &seq1, const string &seq2,
+                 const Scoring &sc, Lanes lanes, Cigar &cigar)
+{
+    const size_t nrow = seq1.length(), ncol = seq2.length(),
+                 lanes_per_vector = (lanes == Lanes::none) ? 1 : simd_lanes(lanes);
+    TraceMatrix trace(nrow, ncol, lanes_per_vector);
+    TraceMatrix gap_trace(sc.affine() ? nrow : 0, ncol, lanes_per_vector);
+    TraceMatrix *gaps = sc.affine() ? &gap_trace : nullptr;
+    float score;
+    if (lanes == Lanes::none)
+    {
+        vector<float> row;
+        last_row(seq1, seq2, sc, row, &trace, gaps);
+        score = row.back();
+    }
+    else
+    {
+        score = fill_antidiagonal(lanes, seq1, seq2, sc, &trace, gaps);
+    }
+    traceback(trace, gaps, seq1, seq2, cigar);
+    return score;
 }
 } // namespace nw
@@ -5,25 +5,371 @@
 #include <sstream> // std::stringstream
 #include <fstream> // std::ifstream
 #include <cstdio>
+#include <cstdint>
+#include <cmath>   // INFINITY
+#include <utility> // std::swap
 
-using Matrix = std::vector<std::vector<float>>;
+// Diagonals lo <= j - i <= hi of the matrix; the cells outside score -inf.
+// A band covers the whole matrix when lo <= -nrow and hi >= ncol.
+struct Band
+{
+  long lo, hi;
+  static Band full(size_t nrow, size_t ncol) { return {-static_cast<long>(nrow), static_cast<long>(ncol)}; }
+  bool covers(size_t nrow, size_t ncol) const { return lo <= -static_cast<long>(nrow) && hi >= static_cast<long>(ncol); }
+  // rows of anti-diagonal d inside the band, before clipping to the matrix
+  long first_row(size_t d) const
+  {
+    const long x = static_cast<long>(d) - hi;
+    return (x > 0) ? (x + 1) / 2 : -(-x / 2);
+  }
+  long last_row(size_t d) const { return (static_cast<long>(d) - lo) / 2; }
+};
+
+// Traceback directions, 2 bits per cell, in the order nw::traceback tries
+// them. Only the interior cells (i, j >= 1) are stored, one anti-diagonal after
+// another, so a vector kernel can write a whole diagonal sequentially: each
+// group of 4 consecutive vectors of `lanes` cells is packed into `lanes`
+// bytes, vector k of the group in bits 2k and 2k + 1. With a band, only the
+// cells inside it are stored.
+class TraceMatrix
+{
+private:
+  size_t m_nrow, m_ncol, m_lanes;
+  std::vector<uint8_t> m_data;
+  std::vector<size_t> m_base;  // byte offset of each anti-diagonal
+  std::vector<size_t> m_first; // first stored row of each anti-diagonal
+
+public:
+  enum Direction : uint8_t
+  {
+    DIAG = 0,
+    LEFT = 1,
+    TOP = 2
+  };
+  // gap_trace bits: the gap ending in this cell extends the one before it
+  enum GapExtension : uint8_t
+  {
+    LEFT_EXTENDS = 1,
+    TOP_EXTENDS = 2
+  };
+  TraceMatrix(size_t nrow, size_t ncol, size_t lanes);
+  TraceMatrix(size_t nrow, size_t ncol, size_t lanes, const Band &band);
+  // first row of the interior of anti-diagonal d (inside the band)
+  size_t first_row(size_t d) const { return m_first[d]; }
+  uint8_t *diagonal(size_t d) { return m_data.data() + m_base[d]; }
+  void set(size_t i, size_t j, uint8_t direction);
+  uint8_t operator()(size_t i, size_t j) const;
+  size_t bytes() const { return m_data.size(); }
+};
+
+// Substitution scores (BLOSUM62, PAM250 or a custom file in NCBI format)
+class SubstitutionMatrix
+{
+private:
+  static constexpr uint8_t UNKNOWN = 255;
+  std::string m_name, m_alphabet;
+  std::vector<float> m_scores; // row-major, m_alphabet.size() squared
+  uint8_t m_code[256];         // residue -> row
+
+public:
+  explicit SubstitutionMatrix(const std::string &name);
+  const std::string &name() const { return m_name; }
+  size_t size() const { return m_alphabet.size(); }
+  const std::vector<float> &scores() const { return m_scores; }
+  uint8_t code(char c) const;
+  float score(char a, char b) const { return m_scores[code(a) * size() + code(b)]; }
+  // Query profile: row c holds the scores of residue c against every
+  // position of `seq` (read backwards if `reverse`), so one row is a
+  // contiguous stream for vector loads or gathers. Rows are `stride` =
+  // length + pad long.
+  template <typename T>
+  void profile(const std::string &seq, bool reverse, size_t pad, std::vector<T> &ans) const
+  {
+    const size_t l = seq.length(), stride = l + pad, n = size();
+    ans.assign(n * stride, 0);
+    for (size_t k = 0; k < l; k++)
+    {
+      const size_t col = code(reverse ? seq[l - k - 1] : seq[k]);
+      for (size_t c = 0; c < n; c++)
+      {
+        ans[c * stride + k] = static_cast<T>(m_scores[c * n + col]);
+      }
+    }
+  }
+};
 
 namespace nw
 {
-std::string read_fasta(const std::string &input_file);
+// Sequence of the first record of a FASTA file, upper-cased and without
+// non-alphabetic characters (common/fasta.h), and its name if `name` is given
+std::string read_fasta(const std::string &input_file, std::string *name = nullptr);
+// Every record of a multi-FASTA file: the first word of its description
+// line, and its sequence as read_fasta gives it
+struct FastaRecord
+{
+  std::string name, sequence;
+};
+std::vector<FastaRecord> read_fasta_records(const std::string &input_file);
 void strip_non_alphabetic(std::string &s);
 void to_upper_case(std::string &s);
 void reverse_string(std::string &s);
 void prepare_sequence(std::string &s);
-void initialize_score_matrix(Matrix &m, float gap_score);
-float score_top_left(Matrix &m,
-                     size_t i, size_t j,
-                     const std::string &seq1, const std::string &seq2,
-                     float match_score, float mismatch_score);
-float score_left(Matrix &m,
-                 size_t i, size_t j, float gap_score);
-float score_top(Matrix &m,
-                size_t i, size_t j, float gap_score);
 float max_score(const float, const float, const float);
 size_t count_gap(const std::string &);
+
+// Which alignments are scored: global (Needleman-Wunsch) from corner to
+// corner; semi-global, where gaps before or after either sequence are free,
+// so the alignment runs from the first row or column to the last row or
+// column; or local (Smith-Waterman), between any two cells.
+enum class Mode
+{
+  global,
+  semiglobal,
+  local
+};
+
+// Scoring scheme. Matches and mismatches have uniform scores unless a
+// substitution matrix is given; a gap of length k costs gap_open + k * gap,
+// so gap_open == 0 is the linear model. Outside global mode the first row
+// and column score 0, and in local mode no cell scores below 0.
+struct Scoring
+{
+  float match, mismatch, gap, gap_open;
+  const SubstitutionMatrix *matrix = nullptr;
+  Mode mode = Mode::global;
+  bool affine() const { return gap_open != 0; }
+};
+
+// Highest-scoring cell of a fill: among the last row and column, where
+// semi-global alignments end, or `anywhere` in the matrix (interior cells
+// only), where local alignments end. Ties go to the earliest anti-diagonal,
+// then the lowest row, so every kernel picks the same cell. A `transposed`
+// fill offers its cells with rows and columns swapped back.
+struct Cell
+{
+  bool anywhere, transposed = false;
+  float score = -INFINITY;
+  size_t i = 0, j = 0;
+  void offer(float s, size_t row, size_t col)
+  {
+    if (transposed)
+    {
+      std::swap(row, col);
+    }
+    if (s > score || (s == score && (row + col < i + j || (row + col == i + j && row < i))))
+    {
+      score = s;
+      i = row;
+      j = col;
+    }
+  }
+};
+
+// Scratch memory of the fill loops. Passing the same one to consecutive
+// alignments (one per thread in batch mode) saves reallocating it each time.
+struct Workspace
+{
+  std::vector<float> row, gaps, profile, diagonals;
+  std::vector<int16_t> cells16, seqs16, profile16;
+  std::vector<int32_t> cells32, seqs32, profile32;
+  std::vector<uint64_t> bits;
+};
+
+// Fill the matrix of seq1 (rows) against seq2 (columns) one row at a time,
+// keeping a single row, and leave its bottom row in `row`. Traceback
+// directions are recorded if `trace` is given; with affine gaps,
+// `gap_trace` records whether each gap extends the previous one. With a
+// `band`, only its cells are filled and only those of `row` are valid. With
+// `best_cell`, the highest cell it asks for is kept there.
+void last_row(const std::string &seq1, const std::string &seq2,
+              const Scoring &sc, std::vector<float> &row,
+              TraceMatrix *trace = nullptr, TraceMatrix *gap_trace = nullptr,
+              const Band *band = nullptr, Workspace *ws = nullptr,
+              Cell *best_cell = nullptr);
+
+// Integer SIMD kernels (simd.cpp). They are only used when every score is a
+// whole number and no cell can leave the range where float arithmetic is
+// exact, so the results are bit-identical to the float implementation.
+// Only three anti-diagonals of scores are kept at any time. Modes and
+// `best_cell` work as in last_row.
+enum class Lanes
+{
+  none,
+  int16,
+  int32
+};
+Lanes integer_lanes(const Scoring &sc, size_t nrow, size_t ncol);
+const char *simd_target(); // instruction set picked at runtime
+size_t simd_lanes(Lanes lanes); // cells per vector, for the TraceMatrix layout
+// Borders of one block of a larger matrix: the row above it and the column
+// to its left (entry 0 is the corner cell in both), with the scores of the
+// alignments ending in a gap along them (F above, E to the left). The fill
+// returns the bottom row and right column of the block the same way.
+struct Edges
+{
+  std::vector<float> top, left, top_gap, left_gap;
+  std::vector<float> bottom, right, bottom_gap, right_gap;
+};
+float fill_antidiagonal(Lanes lanes,
+                        const std::string &seq1, const std::string &seq2,
+                        const Scoring &sc,
+                        TraceMatrix *trace, TraceMatrix *gap_trace = nullptr,
+                        const Band *band = nullptr, Workspace *ws = nullptr,
+                        Edges *edges = nullptr, Cell *best_cell = nullptr);
+constexpr size_t SIMD_PAD = 32; // overhang of the widest vector, in cells
+// Inter-sequence kernel: the scores of up to simd_lanes(lanes) pairs
+// (seq1[k], seq2[k]) at once, one pair per vector lane, for linear gaps and
+// uniform match/mismatch scores. `lanes` must hold the longest pair.
+void score_pairs(Lanes lanes,
+                 const std::vector<const std::string *> &seq1,
+                 const std::vector<const std::string *> &seq2,
+                 const Scoring &sc, float *scores, Workspace *ws = nullptr);
+
+// Final score only, keeping O(min(NROW, NCOL)) cells; the best semi-global
+// or local score outside global mode
+float score_only(const std::string &seq1, const std::string &seq2,
+                 const Scoring &sc, Lanes lanes, Workspace *ws = nullptr);
+
+// Bit-parallel global alignment (myers.cpp). With linear gaps, uniform
+// scores and mismatch == gap + match / 2 (e.g. 0/-1/-1 or 2/-1/-2), every
+// alignment scores match * (length1 + length2) / 2 minus (match - mismatch)
+// times its number of edits, so the best one is the one of least edit
+// distance. Myers' algorithm then fills 64 cells per word operation, the
+// shorter sequence split into 64-row words. edit_last_row gives the same
+// bottom row as last_row; edit_score the final score.
+bool unit_cost(const Scoring &sc);
+void edit_last_row(const std::string &seq1, const std::string &seq2, const Scoring &sc,
+                   std::vector<float> &row, Workspace *ws = nullptr);
+float edit_score(const std::string &seq1, const std::string &seq2, const Scoring &sc,
+                 Workspace *ws = nullptr);
+
+// X-drop screen (xdrop.cpp): the global fill, one anti-diagonal at a time,
+// of only the cells reached from cells at most `x` below the best score of
+// the diagonals before them. An unrelated pair soon has no such cell left,
+// and the fill stops there; a related one fills a band around its path. It
+// reports whether it stopped, on which anti-diagonal, after how many cells,
+// and the best score seen (the corner score when it did not stop, which the
+// full fill can only raise).
+struct XDrop
+{
+  bool terminated;
+  float score;
+  size_t diagonal, cells;
+};
+XDrop xdrop(const std::string &seq1, const std::string &seq2, const Scoring &sc, float x,
+            Workspace *ws = nullptr);
+
+// Semi-global and local alignment (local.cpp). best_end finds the cell where
+// the best alignment of sc.mode ends with a score-only fill. locate then
+// fills the reversed prefixes ending there, anchored at that cell, to find
+// where the alignment starts; the path cannot be longer than its score
+// allows, so this fill stays close to the size of the alignment. The
+// alignment is the global one of seq1[begin1, end1) and seq2[begin2, end2),
+// which any global method can then trace back.
+Cell best_end(const std::string &seq1, const std::string &seq2,
+              const Scoring &sc, Lanes lanes, Workspace *ws = nullptr);
+struct Region
+{
+  float score;
+  size_t begin1, end1, begin2, end2;
+};
+Region locate(const std::string &seq1, const std::string &seq2,
+              const Scoring &sc, Lanes lanes);
+
+// Tiled wavefront fill (tile.cpp): the same bottom row as last_row, from
+// square blocks of the matrix filled by the SIMD kernel. The blocks on one
+// anti-diagonal of blocks are independent and run on `threads` threads;
+// only the borders between blocks are kept, so memory is O(NROW + NCOL).
+void tiled_last_row(const std::string &seq1, const std::string &seq2,
+                    const Scoring &sc, Lanes lanes, int threads,
+                    std::vector<float> &row);
+
+// Alignment path as run-length CIGAR operations in traceback order, i.e.
+// from the bottom-right cell (main reverses the sequences, so that is the
+// order they are read in): '=' a match, 'X' a mismatch, 'I' a residue of
+// seq1 against a gap, 'D' a residue of seq2 against a gap
+struct CigarOp
+{
+  uint32_t length;
+  char op;
+};
+using Cigar = std::vector<CigarOp>;
+// one more column of the path, extending the last run if it is the same
+inline void add_op(Cigar &cigar, char op)
+{
+  if (!cigar.empty() && cigar.back().op == op)
+  {
+    cigar.back().length++;
+  }
+  else
+  {
+    cigar.push_back({1, op});
+  }
+}
+
+// Linear-space alignment (hirschberg.cpp), linear gaps only. With integer
+// `lanes`, the rows are filled by tiled_last_row on `threads` threads.
+float hirschberg(const std::string &seq1, const std::string &seq2,
+                 const Scoring &sc, Cigar &cigar,
+                 Lanes lanes = Lanes::none, int threads = 1);
+
+// Banded alignment (band.cpp): fill the band of half-width `width` around
+// the diagonals of the two corners, doubling it until the optimal path stays
+// off its edges and no path leaving it can score higher, so the score is that
+// of the full matrix. `width` is left at the final half-width. O(n * width).
+float banded(const std::string &seq1, const std::string &seq2,
+             const Scoring &sc, Lanes lanes, size_t &width, Cigar &cigar);
+
+// Batch mode (batch.cpp): scores of every query against every target,
+// row-major, from `threads` threads that steal pairs from each other. With
+// `all_vs_all` the targets are the queries, and only the upper triangle is
+// aligned. Each thread keeps one Workspace for all its pairs. Unless
+// `scalar`, global linear-gap match/mismatch scoring packs one pair per
+// vector lane (score_pairs); anything else aligns pair by pair with
+// score_only, which also gives the semi-global and local scores. With
+// `xdrop` > 0, every pair first goes through the X-drop screen, and the pairs
+// it stops score -inf.
+std::vector<float> align_batch(const std::vector<FastaRecord> &queries,
+                               const std::vector<FastaRecord> &targets,
+                               bool all_vs_all, const Scoring &sc, bool scalar,
+                               int threads, float xdrop = 0);
+// Score matrix as TSV (names in the first row and column) or binary: "NWSM",
+// uint32 rows, uint32 columns, then float32 scores row-major
+void write_score_matrix(const std::string &output_file, bool binary,
+                        const std::vector<FastaRecord> &queries,
+                        const std::vector<FastaRecord> &targets,
+                        const std::vector<float> &scores);
+// Batch mode alignments: the pairs of align_batch, each aligned in full as
+// for a single pair (linear-space once its traceback matrix would exceed
+// `max_matrix_mb`, which affine gaps do not allow) and written as one record
+// per pair in pair order. Pairs the X-drop screen stops are left out.
+void write_batch_alignments(const std::string &output_file,
+                            const std::vector<FastaRecord> &queries,
+                            const std::vector<FastaRecord> &targets,
+                            bool all_vs_all, const Scoring &sc, bool scalar,
+                            int threads, float xdrop, double max_matrix_mb);
+
+// Alignment records (cigar.cpp)
+std::string cigar_string(const Cigar &cigar);
+// share of the columns of the path that are matches
+double identity(const Cigar &cigar);
+// The three rows the text output prints, in the order of `cigar`: seq1 and
+// seq2 with '-' for gaps, and '*' under the matches
+void render(const Cigar &cigar, const std::string &seq1, const std::string &seq2,
+            std::string &res1, std::string &res2, std::string &alignment);
+// One alignment as a tab-separated line: name1, name2, score, identity,
+// first and last residue of seq1 and of seq2 (from 1; `region` holds them
+// from 0, end excluded) and the CIGAR
+void write_alignment(FILE *fout, const std::string &name1, const std::string &name2,
+                     const Region &region, const Cigar &cigar);
+
+// Walk back from the bottom-right cell following the recorded directions,
+// appending the path to `cigar`. With affine gaps, `gap_trace` tells where
+// each gap was opened.
+void traceback(const TraceMatrix &trace, const TraceMatrix *gap_trace,
+               const std::string &seq1, const std::string &seq2, Cigar &cigar);
+// Global alignment with the whole traceback matrix, filled by the vector
+// kernel unless `lanes` is none; returns the score
+float align_full(const std::string &seq1, const std::string &seq2,
+                 const Scoring &sc, Lanes lanes, Cigar &cigar);
 } // namespace nw
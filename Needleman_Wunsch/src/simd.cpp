@@ -0,0 +1,605 @@
+#include "nw.h"
+#include <algorithm> // std::fill, std::max, std::min
+#include <cmath>     // std::fabs, std::floor, INFINITY
+#include <cstring>   // std::memcpy
+#include <limits>    // std::numeric_limits
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// GCC vector extension type holding `BYTES / sizeof(T)` lanes of T
+template <typename T, size_t BYTES>
+struct Vec
+{
+    typedef T type __attribute__((vector_size(BYTES)));
+};
+
+// Workspace buffers of lane type T
+template <typename T>
+struct Scratch
+{
+    vector<T> &cells, &seqs, &profile;
+};
+Scratch<int16_t> scratch(nw::Workspace &ws, int16_t) { return {ws.cells16, ws.seqs16, ws.profile16}; }
+Scratch<int32_t> scratch(nw::Workspace &ws, int32_t) { return {ws.cells32, ws.seqs32, ws.profile32}; }
+
+// Convert a sequence to lane-sized integers (residue codes of `matrix` if
+// given) in `ans`, which must have room for the padding read by vector loads
+// past the end.
+template <typename T>
+void widen(const string &s, bool reverse, const SubstitutionMatrix *matrix, T *ans)
+{
+    const size_t l = s.length();
+    for (size_t i = 0; i < l; i++)
+    {
+        const char c = reverse ? s[l - i - 1] : s[i];
+        ans[i] = matrix ? matrix->code(c) : static_cast<unsigned char>(c);
+    }
+    std::fill(ans + l, ans + l + nw::SIMD_PAD, 0);
+}
+
+// Whole-number scores converted to the lane type. `none` stands for -inf in
+// the affine gap matrices; integer_lanes leaves enough headroom below every
+// reachable score that adding a gap to it cannot overflow or win a max.
+template <typename T>
+struct IntScoring
+{
+    T match, mismatch, gap, open_gap, none;
+    const SubstitutionMatrix *matrix;
+    bool free_start;
+    explicit IntScoring(const nw::Scoring &sc)
+        : match(static_cast<T>(sc.match)), mismatch(static_cast<T>(sc.mismatch)),
+          gap(static_cast<T>(sc.gap)), open_gap(static_cast<T>(sc.gap_open + sc.gap)),
+          none(std::numeric_limits<T>::min() / 2), matrix(sc.matrix),
+          free_start(sc.mode != nw::Mode::global) {}
+    // score of the gap along the first row or column up to cell d
+    T border(size_t d) const
+    {
+        return free_start ? 0 : static_cast<T>(open_gap - gap + static_cast<long long>(d) * gap);
+    }
+    // between lanes and the float scores of nw::Edges, where -inf is `none`
+    T lane(float s) const { return (s == -INFINITY) ? none : static_cast<T>(s); }
+    float score(T s) const { return (s < none / 2) ? -INFINITY : static_cast<float>(s); }
+};
+
+// Fill the matrix one anti-diagonal at a time. With the diagonals indexed by
+// row number, the three neighbours of cell i on diagonal d are cell i - 1 on
+// d - 2 (top-left), cell i on d - 1 (left) and cell i - 1 on d - 1 (top), so
+// every operand of a vector of consecutive cells is a contiguous load. seq2 is
+// read backwards for the same reason. Only the last three diagonals are kept.
+// With AFFINE, the Gotoh gap matrices E (gap in seq1) and F (gap in seq2) are
+// kept the same way, on the last two diagonals. With MATRIX, substitution
+// scores are gathered from the query profile of seq2 (stored backwards like
+// seq2), one profile row per lane, picked by the residue of seq1. A band
+// narrows each diagonal to a contiguous range of rows; the cells on either
+// side of it are set to `none`, which is all the next two diagonals read
+// outside the band. With `edges`, the first row and column come from them
+// instead of the gap penalties, and the last row and column go back to them.
+// CLAMP floors every cell at 0 (local mode). With ANYWHERE, each vector adds
+// its valid lanes to a running maximum of the diagonal, and the diagonal is
+// only searched for its cells when that is as high as `best_cell`; otherwise
+// the last row and column are offered to it as they are reached.
+template <typename T, size_t BYTES, bool AFFINE, bool MATRIX, bool CLAMP, bool ANYWHERE>
+inline __attribute__((always_inline)) T antidiagonal_kernel(
+    const string &seq1, const string &seq2, const IntScoring<T> &sc,
+    TraceMatrix *trace, TraceMatrix *gap_trace, const Band &band,
+    nw::Workspace &ws, nw::Edges *edges, nw::Cell *best_cell)
+{
+    using V = typename Vec<T, BYTES>::type;
+    constexpr size_t LANES = BYTES / sizeof(T);
+    using Packed = typename Vec<uint8_t, LANES>::type;
+    const size_t NROW = seq1.length(), NCOL = seq2.length();
+    const Scratch<T> mem = scratch(ws, T{});
+    mem.seqs.resize(NROW + NCOL + 2 * nw::SIMD_PAD);
+    T *const s1 = mem.seqs.data(), *const s2 = s1 + NROW + nw::SIMD_PAD;
+    widen<T>(seq1, false, sc.matrix, s1);
+    if (MATRIX)
+    {
+        sc.matrix->template profile<T>(seq2, true, nw::SIMD_PAD, mem.profile);
+    }
+    else
+    {
+        widen<T>(seq2, true, nullptr, s2);
+    }
+    const vector<T> &profile = mem.profile;
+    const size_t profile_stride = NCOL + nw::SIMD_PAD;
+    const V vmatch = V{} + sc.match,
+            vmismatch = V{} + sc.mismatch,
+            vgap = V{} + sc.gap,
+            vopen_gap = V{} + sc.open_gap,
+            vleft = V{} + static_cast<T>(TraceMatrix::LEFT),
+            vtop = V{} + static_cast<T>(TraceMatrix::TOP),
+            vnone = V{} + sc.none;
+    V vlane;
+    for (size_t k = 0; k < LANES; k++)
+    {
+        vlane[k] = static_cast<T>(k);
+    }
+    const bool ends = !ANYWHERE && best_cell;
+
+    // H on diagonals d, d - 1 and d - 2, then E and F on d and d - 1,
+    // rotated after each step
+    const size_t stride = NROW + 1 + nw::SIMD_PAD;
+    mem.cells.assign((AFFINE ? 7 : 3) * stride, sc.none);
+    T *cur = mem.cells.data(), *left = cur + stride, *top_left = left + stride,
+      *e_cur = top_left + stride, *e_left = e_cur + stride,
+      *f_cur = e_left + stride, *f_left = f_cur + stride;
+    cur[0] = edges ? sc.lane(edges->top[0]) : 0;
+    if (edges)
+    {
+        edges->bottom.resize(NCOL + 1);
+        edges->right.resize(NROW + 1);
+        edges->bottom_gap.assign(NCOL + 1, -INFINITY);
+        edges->right_gap.assign(NROW + 1, -INFINITY);
+    }
+    if (ends && (NROW == 0 || NCOL == 0))
+    {
+        best_cell->offer(sc.score(cur[0]), 0, 0);
+    }
+    for (size_t d = 1; d <= NROW + NCOL; d++)
+    {
+        std::swap(top_left, left);
+        std::swap(left, cur);
+        if (AFFINE)
+        {
+            std::swap(e_left, e_cur);
+            std::swap(f_left, f_cur);
+        }
+        const long first = std::max<long>((d > NCOL) ? d - NCOL : 1, band.first_row(d)),
+                   last = std::min<long>((d - 1 < NROW) ? d - 1 : NROW, band.last_row(d));
+        if (d >= 2 && first <= last)
+        {
+            const size_t ilo = first, ihi = last;
+            uint8_t *directions = trace ? trace->diagonal(d) : nullptr,
+                    *extensions = gap_trace ? gap_trace->diagonal(d) : nullptr;
+            V packed{}, packed_ext{}, diagonal_max = vnone;
+            unsigned shift = 0;
+            for (size_t i = ilo; i <= ihi; i += LANES)
+            {
+                V a, diag, l, t, l_ext, t_ext;
+                std::memcpy(&a, &s1[i - 1], BYTES);
+                std::memcpy(&diag, top_left + i - 1, BYTES);
+                std::memcpy(&l, left + i, BYTES);
+                std::memcpy(&t, left + i - 1, BYTES);
+                if (MATRIX)
+                {
+                    const T *column = profile.data() + NCOL + i - d;
+                    V sub;
+                    for (size_t k = 0; k < LANES; k++)
+                    {
+                        sub[k] = column[a[k] * profile_stride + k];
+                    }
+                    diag += sub;
+                }
+                else
+                {
+                    V b;
+                    std::memcpy(&b, &s2[NCOL + i - d], BYTES);
+                    diag += (a == b) ? vmatch : vmismatch;
+                }
+                if (AFFINE)
+                {
+                    std::memcpy(&l_ext, e_left + i, BYTES);
+                    std::memcpy(&t_ext, f_left + i - 1, BYTES);
+                    l_ext += vgap;
+                    t_ext += vgap;
+                    l += vopen_gap;
+                    t += vopen_gap;
+                    l = (l_ext >= l) ? l_ext : l;
+                    t = (t_ext >= t) ? t_ext : t;
+                    std::memcpy(e_cur + i, &l, BYTES);
+                    std::memcpy(f_cur + i, &t, BYTES);
+                }
+                else
+                {
+                    l += vgap;
+                    t += vgap;
+                }
+                V best = (l > diag) ? l : diag;
+                best = (t > best) ? t : best;
+                if (CLAMP)
+                {
+                    best = (best > V{}) ? best : V{};
+                }
+                if (ANYWHERE)
+                {
+                    const V valid = vlane < static_cast<T>(std::min<size_t>(ihi + 1 - i, LANES));
+                    const V counted = valid ? best : vnone;
+                    diagonal_max = (counted > diagonal_max) ? counted : diagonal_max;
+                }
+                // lanes past the end of the diagonal are garbage, but stay
+                // inside the padding
+                std::memcpy(cur + i, &best, BYTES);
+                if (directions)
+                {
+                    const V code = (l == best) ? vleft : ((t == best) ? vtop : V{});
+                    packed |= code << shift;
+                    if (AFFINE)
+                    {
+                        const V ext = ((l_ext == l) ? vleft : V{}) | ((t_ext == t) ? vtop : V{});
+                        packed_ext |= ext << shift;
+                    }
+                    shift += 2;
+                    if (shift == 8 || i + LANES > ihi)
+                    {
+                        const Packed bytes = __builtin_convertvector(packed, Packed);
+                        std::memcpy(directions, &bytes, LANES);
+                        directions += LANES;
+                        if (AFFINE)
+                        {
+                            const Packed ext_bytes = __builtin_convertvector(packed_ext, Packed);
+                            std::memcpy(extensions, &ext_bytes, LANES);
+                            extensions += LANES;
+                        }
+                        packed = V{};
+                        packed_ext = V{};
+                        shift = 0;
+                    }
+                }
+            }
+            if (ANYWHERE && best_cell)
+            {
+                T top = sc.none;
+                for (size_t k = 0; k < LANES; k++)
+                {
+                    top = std::max(top, static_cast<T>(diagonal_max[k]));
+                }
+                // a later diagonal never wins a tie; within this one, the
+                // rule of Cell picks among the cells at the maximum
+                if (sc.score(top) > best_cell->score)
+                {
+                    const float score = sc.score(top);
+                    for (size_t i = ilo; i <= ihi; i++)
+                    {
+                        if (cur[i] == top)
+                        {
+                            best_cell->offer(score, i, d - i);
+                        }
+                    }
+                }
+            }
+        }
+        // written after the interior so the overhang cannot overwrite them
+        if (d >= 2 && first <= last)
+        {
+            cur[first - 1] = cur[last + 1] = sc.none;
+            if (AFFINE)
+            {
+                e_cur[first - 1] = e_cur[last + 1] = sc.none;
+                f_cur[first - 1] = f_cur[last + 1] = sc.none;
+            }
+        }
+        if (d <= NCOL && static_cast<long>(d) <= band.hi)
+        {
+            cur[0] = edges ? sc.lane(edges->top[d]) : sc.border(d);
+            if (AFFINE)
+            {
+                f_cur[0] = edges ? sc.lane(edges->top_gap[d]) : sc.none;
+            }
+        }
+        if (d <= NROW && -static_cast<long>(d) >= band.lo)
+        {
+            cur[d] = edges ? sc.lane(edges->left[d]) : sc.border(d);
+            if (AFFINE)
+            {
+                e_cur[d] = edges ? sc.lane(edges->left_gap[d]) : sc.none;
+            }
+        }
+        if (edges && d >= NROW)
+        {
+            edges->bottom[d - NROW] = sc.score(cur[NROW]);
+            if (AFFINE && d > NROW)
+            {
+                edges->bottom_gap[d - NROW] = sc.score(f_cur[NROW]);
+            }
+        }
+        if (edges && d >= NCOL)
+        {
+            edges->right[d - NCOL] = sc.score(cur[d - NCOL]);
+            if (AFFINE && d > NCOL)
+            {
+                edges->right_gap[d - NCOL] = sc.score(e_cur[d - NCOL]);
+            }
+        }
+        if (ends && d >= NCOL)
+        {
+            best_cell->offer(sc.score(cur[d - NCOL]), d - NCOL, NCOL);
+        }
+        if (ends && d >= NROW)
+        {
+            best_cell->offer(sc.score(cur[NROW]), NROW, d - NROW);
+        }
+    }
+    return cur[NROW];
+}
+
+template <typename T, bool AFFINE, bool MATRIX, bool CLAMP, bool ANYWHERE>
+__attribute__((target("avx2"))) T fill_avx2(
+    const string &seq1, const string &seq2, const IntScoring<T> &sc,
+    TraceMatrix *trace, TraceMatrix *gap_trace, const Band &band,
+    nw::Workspace &ws, nw::Edges *edges, nw::Cell *best_cell)
+{
+    return antidiagonal_kernel<T, 32, AFFINE, MATRIX, CLAMP, ANYWHERE>(seq1, seq2, sc, trace, gap_trace, band,
+                                                                      ws, edges, best_cell);
+}
+template <typename T, bool AFFINE, bool MATRIX, bool CLAMP, bool ANYWHERE>
+__attribute__((target("sse4.1"))) T fill_sse41(
+    const string &seq1, const string &seq2, const IntScoring<T> &sc,
+    TraceMatrix *trace, TraceMatrix *gap_trace, const Band &band,
+    nw::Workspace &ws, nw::Edges *edges, nw::Cell *best_cell)
+{
+    return antidiagonal_kernel<T, 16, AFFINE, MATRIX, CLAMP, ANYWHERE>(seq1, seq2, sc, trace, gap_trace, band,
+                                                                      ws, edges, best_cell);
+}
+template <typename T, bool AFFINE, bool MATRIX, bool CLAMP, bool ANYWHERE>
+T fill_generic(
+    const string &seq1, const string &seq2, const IntScoring<T> &sc,
+    TraceMatrix *trace, TraceMatrix *gap_trace, const Band &band,
+    nw::Workspace &ws, nw::Edges *edges, nw::Cell *best_cell)
+{
+    return antidiagonal_kernel<T, 16, AFFINE, MATRIX, CLAMP, ANYWHERE>(seq1, seq2, sc, trace, gap_trace, band,
+                                                                      ws, edges, best_cell);
+}
+
+template <typename T, bool AFFINE, bool MATRIX, bool CLAMP, bool ANYWHERE>
+T dispatch(const string &seq1, const string &seq2, const nw::Scoring &sc,
+           TraceMatrix *trace, TraceMatrix *gap_trace, const Band &band,
+           nw::Workspace &ws, nw::Edges *edges, nw::Cell *best_cell)
+{
+    const IntScoring<T> isc(sc);
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return fill_avx2<T, AFFINE, MATRIX, CLAMP, ANYWHERE>(seq1, seq2, isc, trace, gap_trace, band,
+                                                             ws, edges, best_cell);
+    }
+    else if (__builtin_cpu_supports("sse4.1"))
+    {
+        return fill_sse41<T, AFFINE, MATRIX, CLAMP, ANYWHERE>(seq1, seq2, isc, trace, gap_trace, band,
+                                                              ws, edges, best_cell);
+    }
+    return fill_generic<T, AFFINE, MATRIX, CLAMP, ANYWHERE>(seq1, seq2, isc, trace, gap_trace, band,
+                                                            ws, edges, best_cell);
+}
+
+template <typename T, bool CLAMP, bool ANYWHERE>
+T select_scoring(const string &seq1, const string &seq2, const nw::Scoring &sc,
+                 TraceMatrix *trace, TraceMatrix *gap_trace, const Band &band,
+                 nw::Workspace &ws, nw::Edges *edges, nw::Cell *best_cell)
+{
+    if (sc.affine())
+    {
+        return sc.matrix ? dispatch<T, true, true, CLAMP, ANYWHERE>(seq1, seq2, sc, trace, gap_trace, band,
+                                                                    ws, edges, best_cell)
+                         : dispatch<T, true, false, CLAMP, ANYWHERE>(seq1, seq2, sc, trace, gap_trace, band,
+                                                                     ws, edges, best_cell);
+    }
+    return sc.matrix ? dispatch<T, false, true, CLAMP, ANYWHERE>(seq1, seq2, sc, trace, gap_trace, band,
+                                                                 ws, edges, best_cell)
+                     : dispatch<T, false, false, CLAMP, ANYWHERE>(seq1, seq2, sc, trace, gap_trace, band,
+                                                                  ws, edges, best_cell);
+}
+
+template <typename T>
+T select_kernel(const string &seq1, const string &seq2, const nw::Scoring &sc,
+                TraceMatrix *trace, TraceMatrix *gap_trace, const Band &band,
+                nw::Workspace &ws, nw::Edges *edges, nw::Cell *best_cell)
+{
+    const bool clamp = sc.mode == nw::Mode::local, anywhere = best_cell && best_cell->anywhere;
+    if (clamp)
+    {
+        return anywhere ? select_scoring<T, true, true>(seq1, seq2, sc, trace, gap_trace, band, ws, edges, best_cell)
+                        : select_scoring<T, true, false>(seq1, seq2, sc, trace, gap_trace, band, ws, edges, best_cell);
+    }
+    return anywhere ? select_scoring<T, false, true>(seq1, seq2, sc, trace, gap_trace, band, ws, edges, best_cell)
+                    : select_scoring<T, false, false>(seq1, seq2, sc, trace, gap_trace, band, ws, edges, best_cell);
+}
+
+// Inter-sequence kernel: lane k fills the matrix of pair k row by row, every
+// sequence padded to the longest one on its side (linear gaps, uniform
+// match/mismatch scores). A cell only depends on the cells above and to its
+// left, so the padding never reaches the rectangle of a pair, whose score is
+// read from its own bottom-right cell once its last row is done.
+template <typename T, size_t BYTES>
+inline __attribute__((always_inline)) void interseq_kernel(
+    const vector<const string *> &seq1, const vector<const string *> &seq2,
+    const IntScoring<T> &sc, float *scores, nw::Workspace &ws)
+{
+    using V = typename Vec<T, BYTES>::type;
+    constexpr size_t LANES = BYTES / sizeof(T);
+    const size_t npair = seq1.size();
+    size_t NROW = 0, NCOL = 0;
+    for (size_t k = 0; k < npair; k++)
+    {
+        NROW = std::max(NROW, seq1[k]->length());
+        NCOL = std::max(NCOL, seq2[k]->length());
+    }
+    // residue i of every lane's seq1, then residue j of every lane's seq2
+    const Scratch<T> mem = scratch(ws, T{});
+    mem.seqs.assign((NROW + NCOL) * LANES, 0);
+    T *const a = mem.seqs.data(), *const b = a + NROW * LANES;
+    for (size_t k = 0; k < npair; k++)
+    {
+        for (size_t i = 0; i < seq1[k]->length(); i++)
+        {
+            a[i * LANES + k] = static_cast<unsigned char>((*seq1[k])[i]);
+        }
+        for (size_t j = 0; j < seq2[k]->length(); j++)
+        {
+            b[j * LANES + k] = static_cast<unsigned char>((*seq2[k])[j]);
+        }
+    }
+    mem.cells.resize((NCOL + 1) * LANES);
+    T *const row = mem.cells.data();
+    for (size_t j = 0; j <= NCOL; j++)
+    {
+        std::fill(row + j * LANES, row + (j + 1) * LANES,
+                  static_cast<T>(static_cast<long long>(j) * sc.gap));
+    }
+    auto collect = [&](size_t i) {
+        for (size_t k = 0; k < npair; k++)
+        {
+            if (seq1[k]->length() == i)
+            {
+                scores[k] = row[seq2[k]->length() * LANES + k];
+            }
+        }
+    };
+    collect(0);
+    const V vmatch = V{} + sc.match,
+            vmismatch = V{} + sc.mismatch,
+            vgap = V{} + sc.gap;
+    for (size_t i = 1; i <= NROW; i++)
+    {
+        V ai, top_left, left = V{} + static_cast<T>(static_cast<long long>(i) * sc.gap);
+        std::memcpy(&ai, a + (i - 1) * LANES, BYTES);
+        std::memcpy(&top_left, row, BYTES);
+        std::memcpy(row, &left, BYTES);
+        for (size_t j = 1; j <= NCOL; j++)
+        {
+            V bj, top;
+            std::memcpy(&bj, b + (j - 1) * LANES, BYTES);
+            std::memcpy(&top, row + j * LANES, BYTES);
+            const V diag = top_left + ((ai == bj) ? vmatch : vmismatch),
+                    l = left + vgap,
+                    t = top + vgap;
+            V best = (l > diag) ? l : diag;
+            best = (t > best) ? t : best;
+            std::memcpy(row + j * LANES, &best, BYTES);
+            top_left = top;
+            left = best;
+        }
+        collect(i);
+    }
+}
+
+template <typename T>
+__attribute__((target("avx2"))) void interseq_avx2(
+    const vector<const string *> &seq1, const vector<const string *> &seq2,
+    const IntScoring<T> &sc, float *scores, nw::Workspace &ws)
+{
+    interseq_kernel<T, 32>(seq1, seq2, sc, scores, ws);
+}
+template <typename T>
+__attribute__((target("sse4.1"))) void interseq_sse41(
+    const vector<const string *> &seq1, const vector<const string *> &seq2,
+    const IntScoring<T> &sc, float *scores, nw::Workspace &ws)
+{
+    interseq_kernel<T, 16>(seq1, seq2, sc, scores, ws);
+}
+template <typename T>
+void interseq_generic(
+    const vector<const string *> &seq1, const vector<const string *> &seq2,
+    const IntScoring<T> &sc, float *scores, nw::Workspace &ws)
+{
+    interseq_kernel<T, 16>(seq1, seq2, sc, scores, ws);
+}
+
+template <typename T>
+void interseq_dispatch(const vector<const string *> &seq1, const vector<const string *> &seq2,
+                       const nw::Scoring &sc, float *scores, nw::Workspace &ws)
+{
+    const IntScoring<T> isc(sc);
+    if (__builtin_cpu_supports("avx2"))
+    {
+        interseq_avx2<T>(seq1, seq2, isc, scores, ws);
+    }
+    else if (__builtin_cpu_supports("sse4.1"))
+    {
+        interseq_sse41<T>(seq1, seq2, isc, scores, ws);
+    }
+    else
+    {
+        interseq_generic<T>(seq1, seq2, isc, scores, ws);
+    }
+}
+} // namespace
+
+namespace nw
+{
+Lanes integer_lanes(const Scoring &sc, size_t nrow, size_t ncol)
+{
+    vector<float> scores{sc.gap, sc.gap_open};
+    if (sc.matrix)
+    {
+        scores.insert(scores.end(), sc.matrix->scores().begin(), sc.matrix->scores().end());
+    }
+    else
+    {
+        scores.insert(scores.end(), {sc.match, sc.mismatch});
+    }
+    float largest = 0;
+    for (float s : scores)
+    {
+        if (s != std::floor(s))
+        {
+            return Lanes::none;
+        }
+        largest = std::fabs(s) > largest ? std::fabs(s) : largest;
+    }
+    // Every column of an alignment scores at most |gap_open| + largest, so
+    // |cell| <= bound. Below 2^24 every float sum along the way is exact, so
+    // integer lanes give the same matrix bit for bit. The `none` sentinel of
+    // the gap matrices and of the cells beside a band sits at half the lane
+    // range, and whatever is added to it stays below none + bound: int16
+    // lanes keep bound under |none| / 2, so that IntScoring::score tells
+    // every real cell from it.
+    const double bound = static_cast<double>(largest + std::fabs(sc.gap_open)) * (nrow + ncol);
+    if (bound < 8191)
+    {
+        return Lanes::int16;
+    }
+    if (bound < 16777216)
+    {
+        return Lanes::int32;
+    }
+    return Lanes::none;
+}
+const char *simd_target()
+{
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse4.1"))
+    {
+        return "sse4.1";
+    }
+    return "generic";
+}
+size_t simd_lanes(Lanes lanes)
+{
+    const size_t bytes = __builtin_cpu_supports("avx2") ? 32 : 16;
+    return bytes / ((lanes == Lanes::int16) ? sizeof(int16_t) : sizeof(int32_t));
+}
+float fill_antidiagonal(Lanes lanes,
+                        const string &seq1, const string &seq2, const Scoring &sc,
+                        TraceMatrix *trace, TraceMatrix *gap_trace,
+                        const Band *band, Workspace *ws, Edges *edges, Cell *best_cell)
+{
+    const Band b = band ? *band : Band::full(seq1.length(), seq2.length());
+    Workspace local;
+    Workspace &w = ws ? *ws : local;
+    if (lanes == Lanes::int16)
+    {
+        return select_kernel<int16_t>(seq1, seq2, sc, trace, gap_trace, b, w, edges, best_cell);
+    }
+    return select_kernel<int32_t>(seq1, seq2, sc, trace, gap_trace, b, w, edges, best_cell);
+}
+void score_pairs(Lanes lanes,
+                 const vector<const string *> &seq1, const vector<const string *> &seq2,
+                 const Scoring &sc, float *scores, Workspace *ws)
+{
+    Workspace local;
+    Workspace &w = ws ? *ws : local;
+    if (lanes == Lanes::int16)
+    {
+        interseq_dispatch<int16_t>(seq1, seq2, sc, scores, w);
+    }
+    else
+    {
+        interseq_dispatch<int32_t>(seq1, seq2, sc, scores, w);
+    }
+}
+} // namespace nw
@@ -0,0 +1,84 @@
+#include "nw.h"
+#include <algorithm> // std::copy, std::max, std::min
+#include <cmath>     // INFINITY
+#include <omp.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// Side of a block, in cells: the three diagonals the kernel keeps for a
+// block stay in the L1/L2 cache, and a block is still long enough to fill
+// the vectors and amortize the per-block setup.
+const size_t TILE = 2048;
+
+// score of the first row or column up to cell k
+float border(const nw::Scoring &sc, size_t k)
+{
+    return (k == 0) ? 0 : (sc.affine() ? sc.gap_open : 0) + static_cast<float>(k) * sc.gap;
+}
+} // namespace
+
+namespace nw
+{
+void tiled_last_row(const string &seq1, const string &seq2,
+                    const Scoring &sc, Lanes lanes, int threads,
+                    vector<float> &row)
+{
+    const size_t NROW = seq1.length(), NCOL = seq2.length(),
+                 nblock_rows = (NROW + TILE - 1) / TILE,
+                 nblock_cols = (NCOL + TILE - 1) / TILE;
+    // The bottom row of the last block done in each block column and the
+    // right column of the last block done in each block row. A block
+    // overwrites the borders it read, so the corner above-left of the next
+    // block in its column is kept apart.
+    vector<float> h_row(NCOL + 1), f_row(NCOL + 1, -INFINITY),
+        h_col(NROW + 1), e_col(NROW + 1, -INFINITY), corner(nblock_cols);
+    for (size_t j = 0; j <= NCOL; j++)
+    {
+        h_row[j] = border(sc, j);
+    }
+    for (size_t i = 0; i <= NROW; i++)
+    {
+        h_col[i] = border(sc, i);
+    }
+    for (size_t bj = 0; bj < nblock_cols; bj++)
+    {
+        corner[bj] = h_row[bj * TILE];
+    }
+    vector<Workspace> ws(threads);
+    vector<Edges> edges(threads);
+    for (size_t d = 0; nblock_rows > 0 && d + 1 < nblock_rows + nblock_cols; d++)
+    {
+        const long first = (d >= nblock_cols) ? d - nblock_cols + 1 : 0,
+                   last = std::min(d, nblock_rows - 1);
+#pragma omp parallel for num_threads(threads) schedule(dynamic)
+        for (long bi = first; bi <= last; bi++)
+        {
+            const size_t bj = d - bi, r0 = bi * TILE, c0 = bj * TILE,
+                         rows = std::min(TILE, NROW - r0), cols = std::min(TILE, NCOL - c0);
+            Edges &e = edges[omp_get_thread_num()];
+            // entry 0 is the corner, which the blocks either side of this
+            // one on the same anti-diagonal write in h_row and h_col
+            e.top.assign(1, corner[bj]);
+            e.top.insert(e.top.end(), h_row.begin() + c0 + 1, h_row.begin() + c0 + cols + 1);
+            e.top_gap.assign(1, -INFINITY);
+            e.top_gap.insert(e.top_gap.end(), f_row.begin() + c0 + 1, f_row.begin() + c0 + cols + 1);
+            e.left.assign(1, corner[bj]);
+            e.left.insert(e.left.end(), h_col.begin() + r0 + 1, h_col.begin() + r0 + rows + 1);
+            e.left_gap.assign(1, -INFINITY);
+            e.left_gap.insert(e.left_gap.end(), e_col.begin() + r0 + 1, e_col.begin() + r0 + rows + 1);
+            fill_antidiagonal(lanes, seq1.substr(r0, rows), seq2.substr(c0, cols), sc,
+                              nullptr, nullptr, nullptr, &ws[omp_get_thread_num()], &e);
+            corner[bj] = e.left[rows];
+            std::copy(e.bottom.begin() + 1, e.bottom.end(), h_row.begin() + c0 + 1);
+            std::copy(e.bottom_gap.begin() + 1, e.bottom_gap.end(), f_row.begin() + c0 + 1);
+            std::copy(e.right.begin() + 1, e.right.end(), h_col.begin() + r0 + 1);
+            std::copy(e.right_gap.begin() + 1, e.right_gap.end(), e_col.begin() + r0 + 1);
+        }
+    }
+    h_row[0] = border(sc, NROW);
+    row.swap(h_row);
+}
+} // namespace nw
@@ -0,0 +1,120 @@
+#include "nw.h"
+#include <algorithm> // std::max, std::min, std::swap
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// score of the gap along the first row or column up to cell k
+float border(const nw::Scoring &sc, size_t k)
+{
+    return (k == 0) ? 0 : (sc.affine() ? sc.gap_open : 0) + static_cast<float>(k) * sc.gap;
+}
+} // namespace
+
+namespace nw
+{
+XDrop xdrop(const string &seq1, const string &seq2, const Scoring &sc, float x,
+            Workspace *ws)
+{
+    // the result is the same for the transpose, so the shorter sequence takes
+    // the rows, which index the diagonals kept in memory
+    const bool rows_shorter = seq1.length() <= seq2.length();
+    const string &rows = rows_shorter ? seq1 : seq2, &cols = rows_shorter ? seq2 : seq1;
+    const size_t NROW = rows.length(), NCOL = cols.length(), stride = NROW + 3;
+    const float NONE = -INFINITY, open_gap = sc.gap_open + sc.gap;
+    Workspace local;
+    Workspace &w = ws ? *ws : local;
+    // H on diagonals d, d - 1 and d - 2, then E and F on d and d - 1, with a
+    // slot for the sentinel on either side of rows 0 to NROW
+    w.diagonals.assign((sc.affine() ? 7 : 3) * stride, NONE);
+    float *cur = w.diagonals.data() + 1, *left = cur + stride, *top_left = left + stride,
+          *e_cur = top_left + stride, *e_left = e_cur + stride,
+          *f_cur = e_left + stride, *f_left = f_cur + stride;
+    XDrop result{false, NONE, 0, 1};
+    cur[0] = 0;
+    float best = 0;
+    // live rows of the last diagonal: the cells at most x below `best`
+    size_t live_first = 0, live_last = 0;
+    for (size_t d = 1; d <= NROW + NCOL; d++)
+    {
+        std::swap(top_left, left);
+        std::swap(left, cur);
+        if (sc.affine())
+        {
+            std::swap(e_left, e_cur);
+            std::swap(f_left, f_cur);
+        }
+        // a cell needs a live cell to its left or above it
+        const size_t first = std::max(live_first, (d > NCOL) ? d - NCOL : 0),
+                     last = std::min(std::min(live_last + 1, NROW), d);
+        const float threshold = best - x;
+        float diagonal_best = NONE;
+        size_t next_first = last + 1, next_last = 0;
+        for (size_t i = first; i <= last; i++)
+        {
+            const size_t j = d - i;
+            float h, e = NONE, f = NONE;
+            if (i == 0 || j == 0)
+            {
+                h = border(sc, d);
+            }
+            else
+            {
+                const float sub = sc.matrix ? sc.matrix->score(rows[i - 1], cols[j - 1])
+                                            : (rows[i - 1] == cols[j - 1]) ? sc.match : sc.mismatch;
+                if (sc.affine())
+                {
+                    e = std::max(e_left[i] + sc.gap, left[i] + open_gap);
+                    f = std::max(f_left[i - 1] + sc.gap, left[i - 1] + open_gap);
+                }
+                else
+                {
+                    e = left[i] + sc.gap;
+                    f = left[i - 1] + sc.gap;
+                }
+                h = max_score(e, top_left[i - 1] + sub, f);
+            }
+            if (h < threshold)
+            {
+                h = e = f = NONE;
+            }
+            else
+            {
+                next_first = std::min(next_first, i);
+                next_last = i;
+                diagonal_best = std::max(diagonal_best, h);
+            }
+            cur[i] = h;
+            if (sc.affine())
+            {
+                e_cur[i] = e;
+                f_cur[i] = f;
+            }
+        }
+        result.cells += (first <= last) ? last + 1 - first : 0;
+        if (next_first > next_last)
+        {
+            result.terminated = true;
+            result.diagonal = d;
+            result.score = best;
+            return result;
+        }
+        // the next two diagonals read one row past the live cells on either side
+        const long before = static_cast<long>(next_first) - 1, after = next_last + 1;
+        cur[before] = cur[after] = NONE;
+        if (sc.affine())
+        {
+            e_cur[before] = e_cur[after] = NONE;
+            f_cur[before] = f_cur[after] = NONE;
+        }
+        live_first = next_first;
+        live_last = next_last;
+        best = std::max(best, diagonal_best);
+    }
+    result.diagonal = NROW + NCOL;
+    result.score = cur[NROW];
+    return result;
+}
+} // namespace nw
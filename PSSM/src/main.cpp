@@ -3,105 +3,395 @@
  * Author: Yi Zhou
 */
 #include "pssm.h"
-#include <map>
+#include "fasta.h"
+#include <chrono>
+#include <iostream>
 
 using namespace std;
 
 const float PSEUDOCOUNT = 0.25;
+// Bases of the genome read and scanned at a time
+const size_t CHUNK = 1 << 22;
 
-int main(int argc, char **argv)
+// Build the PSSM of the aligned motif sequences in `motifs`, and set
+// `min_training_score` to the lowest score among them. `verbose` prints the
+// frequency matrix, the PSSM and the training set scores.
+PSSM train(Svec &motifs, const vector<float> &background_prob,
+           bool verbose, float &min_training_score)
 {
-    if (argc < 3 || argc > 4)
-    {
-        printf("[ERROR] %s takes 2 or 3 arguments, but %d were given.\n\n"
-               "Usage: %s <motif_text_file> <DNA_fasta_file> [minimum_score_cutoff]\n\n"
-               "This program implements the PSSM for supervised motif finding.\n"
-               "If minimum_score_cutoff is omitted, max(0, lowest_score_among_sequences)\n"
-               "in the training set is used.\n",
-               argv[0], argc - 1, argv[0]);
-        return 1;
-    }
-    // Read aligned motif sequences and the DNA sequence
-    Svec motifs = preprocess::read_motifs(argv[1]);
-    string DNA = preprocess::read_DNA(argv[2]);
-    preprocess::normalize_sequence(DNA);
     for (auto &s : motifs)
     {
         preprocess::to_upper_case(s);
     }
 
     // Construct frequency matrix
-    PSSM ans(motifs, DNA);
-    printf("\nFrequency matrix:");
-    ans.print_score_matrix(0);
+    PSSM ans(motifs, background_prob);
+    if (verbose)
+    {
+        printf("\nFrequency matrix:");
+        ans.print_score_matrix(0);
+    }
 
     // Add pseudo-counts to the frequency matrix
     ans.add_pseudocount(PSEUDOCOUNT);
 
     // Convert to score matrix
     ans.convert_to_score_matrix();
-    printf("\nPSSM:");
-    ans.print_score_matrix(3);
+    if (verbose)
+    {
+        printf("\nPSSM:");
+        ans.print_score_matrix(3);
+    }
 
     // Calculate scores for motif sequences in the input alignment
-    printf("\nTraining set motif scores:\n");
-    const size_t motif_num = motifs.size(),
-                 motif_len = motifs[0].size();
+    if (verbose)
+    {
+        printf("\nTraining set motif scores:\n");
+    }
+    const size_t motif_num = motifs.size();
     size_t min_motif_score_idx = 0;
     vector<float> input_motif_scores(motif_num);
     for (size_t i = 0; i < motif_num; i++)
     {
         input_motif_scores[i] = ans.calc_score_for_forward(motifs[i], 0);
-        printf("\t%s\t%.3f\n", motifs[i].c_str(), input_motif_scores[i]);
+        if (verbose)
+        {
+            printf("\t%s\t%.3f\n", motifs[i].c_str(), input_motif_scores[i]);
+        }
         if (input_motif_scores[min_motif_score_idx] > input_motif_scores[i])
         {
             min_motif_score_idx = i;
         }
     }
+    min_training_score = input_motif_scores[min_motif_score_idx];
 
     // Invert the PSSM to represent the complementary strand
     ans.generate_reverse_matrix();
+    return ans;
+}
+
+// Name of a motif in the library: its file name without directory and
+// extension
+string motif_name(const string &path)
+{
+    const size_t slash = path.find_last_of('/'),
+                 start = (slash == string::npos) ? 0 : slash + 1,
+                 dot = path.find_last_of('.');
+    return path.substr(start, (dot == string::npos || dot < start) ? string::npos : dot - start);
+}
+
+// Whether the genome composition gives every base a finite score; if not,
+// print why. A base missing from the genome would score log2(f / 0) = +inf
+// (and its complement on the other strand), in the scan and in the score
+// distribution of --pvalue alike.
+bool usable_background(const string &DNA_path, const vector<float> &background, size_t DNA_len)
+{
+    if (DNA_len == 0)
+    {
+        printf("[ERROR] No A, C, G or T in %s\n", DNA_path.c_str());
+        return false;
+    }
+    for (size_t k = 0; k < 4; k++)
+    {
+        if (!(background[k] > 0))
+        {
+            printf("[ERROR] No %c in %s: its PSSM scores would be infinite\n", "ACGT"[k], DNA_path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parse a p-value or score cutoff in a server request; false if `text` is
+// not a number
+bool parse_number(const string &text, double &value)
+{
+    char *end = nullptr;
+    value = strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0';
+}
+
+// Answer scan requests read from stdin, one per line, on the genome of
+// DNA_path, read and coded once:
+//     <motif_text_file> [minimum_score_cutoff | --pvalue=P]
+// The answer is a line per hit, "record start end strand sequence score"
+// separated by tabs, then a line starting with '#': the hit count, or the
+// error. The input ends with "quit" or end of file.
+int serve(const string &DNA_path)
+{
+    size_t DNA_len;
+    const vector<Record> records = preprocess::read_records(DNA_path);
+    const vector<float> background = preprocess::background_prob(records, DNA_len);
+    if (!usable_background(DNA_path, background, DNA_len))
+    {
+        return 1;
+    }
+    fprintf(stderr, "Serving %s: %zu record%s, %zu bp\n", DNA_path.c_str(), records.size(),
+            (records.size() == 1) ? "" : "s", DNA_len);
+
+    string line;
+    while (getline(std::cin, line))
+    {
+        std::istringstream words(line);
+        Svec request;
+        for (string word; words >> word;)
+        {
+            request.push_back(word);
+        }
+        if (request.empty())
+        {
+            continue;
+        }
+        if (request[0] == "quit")
+        {
+            break;
+        }
+        const auto start = std::chrono::steady_clock::now();
+
+        // the same cutoffs as on the command line
+        const string pvalue_flag = "--pvalue";
+        double cutoff = 0;
+        bool use_pvalue = false, valid = request.size() <= 3;
+        if (valid && request.size() == 3)
+        {
+            valid = request[1] == pvalue_flag && parse_number(request[2], cutoff);
+            use_pvalue = true;
+        }
+        else if (valid && request.size() == 2)
+        {
+            use_pvalue = request[1].compare(0, pvalue_flag.size() + 1, pvalue_flag + "=") == 0;
+            valid = parse_number(use_pvalue ? request[1].substr(pvalue_flag.size() + 1) : request[1], cutoff);
+        }
+        if (!valid || (use_pvalue && !(cutoff > 0 && cutoff <= 1)))
+        {
+            printf("# error: expected <motif_text_file> [minimum_score_cutoff | --pvalue=P]\n");
+            fflush(stdout);
+            continue;
+        }
+        // read_motifs ends the program on a file it cannot open
+        Svec motifs;
+        if (std::ifstream(request[0]).is_open())
+        {
+            motifs = preprocess::read_motifs(request[0]);
+        }
+        while (!motifs.empty() && motifs.back().empty())
+        {
+            motifs.pop_back();
+        }
+        bool aligned = !motifs.empty() && !motifs[0].empty();
+        for (const auto &motif : motifs)
+        {
+            aligned = aligned && motif.size() == motifs[0].size();
+        }
+        if (!aligned)
+        {
+            printf("# error: no aligned motifs in %s\n", request[0].c_str());
+            fflush(stdout);
+            continue;
+        }
 
-    // Scan the direct and complementary strands for the motif
-    const float MIN_SCORE = (argc == 4) ? stof(argv[3]) : input_motif_scores[min_motif_score_idx];
-    printf("\nMatches with score %.3f or higher found in %s (length %zu bp):\n"
-           "%-10s%-10s%-8s%-25s%-10s\n",
-           MIN_SCORE, argv[2], DNA.size(),
-           "Start", "End", "Strand", "Sequence", "Score");
-
-    const size_t i_max = DNA.size() - motif_len + 1;
-    const char fmt[] = "%-10zu%-10zu%-8c%-25s%-10.3f\n";
-    map<size_t, string> hits;
-    size_t hit_num = 0;
-#pragma omp parallel for
-    for (size_t i = 0; i < i_max; i++)
-    {
-        float forward_score = ans.calc_score_for_forward(DNA, i),
-              reverse_score = ans.calc_score_for_reverse(DNA, i);
-        if (forward_score >= MIN_SCORE)
-        {
-            char buf[65];
-            sprintf(buf, fmt,
-                    i + 1, i + motif_len, '+',
-                    DNA.substr(i, motif_len).c_str(),
-                    forward_score);
-            size_t buf_id = i + hit_num++;
-            hits.insert(pair<size_t, string>(buf_id, buf));
-        }
-        if (reverse_score >= MIN_SCORE)
-        {
-            char buf[65];
-            sprintf(buf, fmt,
-                    i + 1, i + motif_len, '-',
-                    ans.generate_reverse_strand(DNA.substr(i, motif_len)).c_str(),
-                    reverse_score);
-            size_t buf_id = i + hit_num++;
-            hits.insert(pair<size_t, string>(buf_id, buf));
-        }
-    }
-    for (auto &c : hits)
-    {
-        printf("%s", c.second.c_str());
+        float min_training_score;
+        const PSSM pssm = train(motifs, background, false, min_training_score);
+        const float min_score = (request.size() == 1) ? min_training_score
+                                : use_pvalue          ? pssm.score_for_pvalue(cutoff)
+                                                      : static_cast<float>(cutoff);
+        size_t hit_num = 0;
+        for (const auto &record : records)
+        {
+            for (const auto &hit : find_hits({&pssm}, {min_score}, record.codes))
+            {
+                const string window = preprocess::decode_DNA(record.codes, hit.start, pssm.motif_len());
+                printf("%s\t%zu\t%zu\t%c\t%s\t%.3f\n", record.name.c_str(),
+                       hit.start + 1, hit.start + pssm.motif_len(), hit.strand,
+                       (hit.strand == '+') ? window.c_str() : pssm.generate_reverse_strand(window).c_str(),
+                       hit.score);
+                hit_num++;
+            }
+        }
+        printf("# %zu hits with score %.3f or higher in %.1f ms\n", hit_num, min_score,
+               std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        fflush(stdout);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    // --pvalue=P (or --pvalue P) and --verbose may come anywhere; the rest
+    // are positional
+    Svec args;
+    double pvalue = 0;
+    bool use_pvalue = false;
+    for (int a = 1; a < argc; a++)
+    {
+        const string arg = argv[a], pvalue_flag = "--pvalue";
+        if (arg.compare(0, pvalue_flag.size() + 1, pvalue_flag + "=") == 0)
+        {
+            pvalue = stod(arg.substr(pvalue_flag.size() + 1));
+            use_pvalue = true;
+        }
+        else if (arg == pvalue_flag && a + 1 < argc)
+        {
+            pvalue = stod(argv[++a]);
+            use_pvalue = true;
+        }
+        else if (arg == "--verbose")
+        {
+            fasta::verbose = true;
+        }
+        else
+        {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() == 2 && args[0] == "--serve" && !use_pvalue)
+    {
+        return serve(args[1]);
+    }
+    if (args.size() < 2 || args.size() > 3)
+    {
+        printf("[ERROR] %s takes 2 or 3 arguments, but %zu were given.\n\n"
+               "Usage: %s <motif_text_file> <DNA_fasta_file> [minimum_score_cutoff | --pvalue=P]\n"
+               "       %s --library=<motif_list_file> <DNA_fasta_file> [minimum_score_cutoff | --pvalue=P]\n"
+               "       %s --serve <DNA_fasta_file>\n\n"
+               "This program implements the PSSM for supervised motif finding.\n"
+               "If minimum_score_cutoff is omitted, max(0, lowest_score_among_sequences)\n"
+               "in the training set is used.\n\n"
+               "--pvalue=P sets the cutoff of each motif instead: the lowest score that\n"
+               "a window of the DNA background composition reaches with probability\n"
+               "at most P (0 < P <= 1), from the exact score distribution.\n\n"
+               "--verbose reports the records, bases and read speed of DNA_fasta_file\n"
+               "on standard error.\n\n"
+               "Each record of DNA_fasta_file is scanned on its own; with several\n"
+               "records, matches name their record and count from its start.\n\n"
+               "With --library, motif_list_file names one motif text file per line\n"
+               "(blank lines and lines starting with '#' are skipped). Every motif is\n"
+               "scanned in one pass over the DNA, each with its own cutoff, and the\n"
+               "matches are tagged with the motif file name.\n\n"
+               "With --serve, DNA_fasta_file is read once and every line of the input\n"
+               "is a scan request, \"<motif_text_file> [minimum_score_cutoff | --pvalue=P]\",\n"
+               "answered with one tab-separated line per match (record, start, end,\n"
+               "strand, sequence, score) and a last line starting with '#'. The input\n"
+               "ends with \"quit\".\n",
+               argv[0], args.size(), argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    if (use_pvalue && (args.size() == 3 || !(pvalue > 0 && pvalue <= 1)))
+    {
+        printf("[ERROR] --pvalue takes a probability in (0, 1], and replaces minimum_score_cutoff.\n");
+        return 1;
+    }
+    const string library_flag = "--library=", first = args[0], DNA_path = args[1];
+    const bool library_mode = first.compare(0, library_flag.size(), library_flag) == 0;
+    // the cutoff of a motif: given, from the p-value, or from its training set
+    auto cutoff = [&](const PSSM &pssm, float min_training_score) {
+        return (args.size() == 3) ? stof(args[2])
+                                  : use_pvalue ? pssm.score_for_pvalue(pvalue) : min_training_score;
+    };
+
+    // Read the DNA composition; the sequence itself is only streamed, one
+    // chunk at a time, when it is scanned. A pipe cannot be read twice, so
+    // its records are kept in memory from the first pass instead.
+    size_t records, DNA_len;
+    vector<Record> in_memory;
+    vector<float> background;
+    if (preprocess::rereadable(DNA_path))
+    {
+        background = preprocess::background_prob(DNA_path, records, DNA_len);
+    }
+    else
+    {
+        in_memory = preprocess::read_records(DNA_path);
+        background = preprocess::background_prob(in_memory, DNA_len);
+        records = in_memory.size();
+    }
+    if (!usable_background(DNA_path, background, DNA_len))
+    {
+        return 1;
+    }
+    // with several records, a hit names its own and counts from its start
+    const bool show_record = records > 1;
+
+    vector<PSSM> library;
+    vector<float> min_scores;
+    Svec names;
+    if (library_mode)
+    {
+        const Svec paths = preprocess::read_library(first.substr(library_flag.size()));
+        if (paths.empty())
+        {
+            printf("[ERROR] No motif file listed in %s\n", first.substr(library_flag.size()).c_str());
+            return 1;
+        }
+        library.reserve(paths.size());
+        printf("\nMotif library (%zu motifs):\n%-20s%-10s%-12s%-10s\n",
+               paths.size(), "Motif", "Length", "Sequences", "Cutoff");
+        for (const auto &path : paths)
+        {
+            Svec motifs = preprocess::read_motifs(path);
+            float min_training_score;
+            library.push_back(train(motifs, background, false, min_training_score));
+            min_scores.push_back(cutoff(library.back(), min_training_score));
+            names.push_back(motif_name(path));
+            printf("%-20s%-10zu%-12zu%-10.3f\n", names.back().c_str(),
+                   motifs[0].size(), motifs.size(), min_scores.back());
+        }
+        printf("\nMatches found in %s (length %zu bp):\n%-20s", DNA_path.c_str(), DNA_len, "Motif");
+    }
+    else
+    {
+        // Read aligned motif sequences and build their PSSM
+        Svec motifs = preprocess::read_motifs(first);
+        float min_training_score;
+        library.push_back(train(motifs, background, true, min_training_score));
+        min_scores.push_back(cutoff(library.back(), min_training_score));
+        if (use_pvalue)
+        {
+            printf("\nScore cutoff for p-value %g: %.3f\n", pvalue, min_scores[0]);
+        }
+        printf("\nMatches with score %.3f or higher found in %s (length %zu bp):\n",
+               min_scores[0], DNA_path.c_str(), DNA_len);
+    }
+    if (show_record)
+    {
+        printf("%-20s", "Record");
+    }
+    printf("%-10s%-10s%-8s%-25s%-10s\n", "Start", "End", "Strand", "Sequence", "Score");
+
+    // Scan the direct and complementary strands for every motif
+    vector<const PSSM *> pointers;
+    for (const auto &pssm : library)
+    {
+        pointers.push_back(&pssm);
+    }
+    const HitReport report = [&](const string &record, const string &codes, size_t offset,
+                                 const vector<Hit> &hits) {
+        for (const auto &hit : hits)
+        {
+            const PSSM &pssm = library[hit.motif];
+            const size_t motif_len = pssm.motif_len(), start = offset + hit.start;
+            const string window = preprocess::decode_DNA(codes, hit.start, motif_len);
+            if (library_mode)
+            {
+                printf("%-20s", names[hit.motif].c_str());
+            }
+            if (show_record)
+            {
+                printf("%-20s", record.c_str());
+            }
+            printf("%-10zu%-10zu%-8c%-25s%-10.3f\n",
+                   start + 1, start + motif_len, hit.strand,
+                   (hit.strand == '+') ? window.c_str() : pssm.generate_reverse_strand(window).c_str(),
+                   hit.score);
+        }
+    };
+    if (in_memory.empty())
+    {
+        scan_fasta(DNA_path, pointers, min_scores, CHUNK, report);
+    }
+    for (const auto &record : in_memory)
+    {
+        report(record.name, record.codes, 0, find_hits(pointers, min_scores, record.codes));
     }
     return 0;
 }
@@ -1,27 +1,72 @@
 #include "pssm.h"
+#include "fasta.h"
+#include <algorithm> // std::copy, std::max_element, std::min_element
 
 using std::string;
 using std::vector;
 
 namespace preprocess
 {
-string read_DNA(const string &DNA_path)
+vector<Record> read_records(const string &DNA_path)
 {
-    std::ifstream fin(DNA_path);
-    std::stringstream buffer;
-    string firstline;
-    if (fin.is_open())
+    fasta::Reader reader(DNA_path, fasta::Alphabet::dna_codes);
+    vector<Record> records;
+    Record record;
+    while (reader.next(record.name, record.codes))
     {
-        getline(fin, firstline);
-        buffer << fin.rdbuf();
-        fin.close();
-        return buffer.str();
+        record.codes.shrink_to_fit();
+        records.push_back(std::move(record));
     }
-    else
+    reader.report();
+    return records;
+}
+
+string decode_DNA(const string &codes, size_t i, size_t len)
+{
+    string ans(len, 'x');
+    for (size_t k = 0; k < len; k++)
     {
-        printf("Cannot open file: %s\n", DNA_path.c_str());
-        exit(1);
+        ans[k] = "ACGT"[static_cast<unsigned char>(codes[i + k])];
+    }
+    return ans;
+}
+
+vector<float> background_prob(const vector<Record> &records, size_t &DNA_len)
+{
+    // counted in integers: a float count stops growing at 2^24
+    size_t counts[4] = {0, 0, 0, 0};
+    for (const auto &record : records)
+    {
+        for (const char c : record.codes)
+        {
+            counts[static_cast<unsigned char>(c)]++;
+        }
+    }
+    DNA_len = counts[0] + counts[1] + counts[2] + counts[3];
+    vector<float> ans(4, 0);
+    for (size_t k = 0; k < 4 && DNA_len > 0; k++)
+    {
+        ans[k] = static_cast<float>(counts[k]) / DNA_len;
     }
+    return ans;
+}
+
+Svec read_library(const string &library_path)
+{
+    // blank lines and lines starting with '#' are skipped
+    Svec paths;
+    for (auto &line : read_motifs(library_path))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] != '#')
+        {
+            paths.emplace_back(line);
+        }
+    }
+    return paths;
 }
 
 Svec read_motifs(const string &motif_path)
@@ -59,27 +104,15 @@ void to_upper_case(string &s)
         }
     }
 }
-void normalize_sequence(string &s)
-{
-    size_t i = 0;
-    for (auto &c : s)
-    {
-        if (c == 'A' || c == 'C' || c == 'G' || c == 'T')
-        {
-            s[i] = c;
-            i++;
-        }
-    }
-    s = s.substr(0, i);
-}
 } // namespace preprocess
 
-PSSM::PSSM(const Svec &motifs, const string &DNA)
+PSSM::PSSM(const Svec &motifs, const vector<float> &background_prob)
+    : m_background_prob(background_prob)
 {
     const size_t motif_num = motifs.size();
     assert(motif_num > 0);
     m_motif_len = motifs[0].size();
-    m_score_matrix.resize(m_motif_len);
+    m_score_matrix.resize(4 * m_motif_len);
     for (size_t j = 0; j < m_motif_len; j++)
     {
         string col(motif_num, 'x');
@@ -87,14 +120,8 @@ PSSM::PSSM(const Svec &motifs, const string &DNA)
         {
             col[i] = motifs[i][j];
         }
-        m_score_matrix[j] = count_char_occurrence(col);
-    }
-    m_background_prob = count_char_occurrence(DNA);
-    const size_t DNA_len = DNA.size();
-    assert(DNA_len > 0);
-    for (auto &score : m_background_prob)
-    {
-        score /= DNA_len;
+        const vector<float> counts = count_char_occurrence(col);
+        std::copy(counts.begin(), counts.end(), m_score_matrix.begin() + 4 * j);
     }
 }
 
@@ -132,9 +159,9 @@ void PSSM::print_score_matrix(const unsigned rounding)
     for (size_t i = 0; i < m_motif_len; i++)
     {
         printf("%10zu", i + 1);
-        for (auto &score : m_score_matrix[i])
+        for (size_t k = 0; k < 4; k++)
         {
-            printf("%10.*f", rounding, score);
+            printf("%10.*f", rounding, m_score_matrix[4 * i + k]);
         }
         printf("\n");
     }
@@ -142,81 +169,88 @@ void PSSM::print_score_matrix(const unsigned rounding)
 
 void PSSM::add_pseudocount(const float pc)
 {
-    for (auto &row : m_score_matrix)
+    for (auto &score : m_score_matrix)
     {
-        for (auto &score : row)
-        {
-            score += pc;
-        }
+        score += pc;
     }
 }
 
 void PSSM::convert_to_score_matrix()
 {
-    for (auto &row : m_score_matrix)
+    for (size_t j = 0; j < m_motif_len; j++)
     {
+        float *row = &m_score_matrix[4 * j];
         float total_score = 0.0;
-        for (auto &freq_pseudo : row)
+        for (size_t i = 0; i < 4; i++)
         {
-            total_score += freq_pseudo;
+            total_score += row[i];
         }
-        const size_t row_size = row.size();
-        for (size_t i = 0; i < row_size; i++)
+        for (size_t i = 0; i < 4; i++)
         {
             row[i] = std::log2(row[i] / (total_score * m_background_prob[i]));
         }
     }
 }
 
-void PSSM::generate_reverse_matrix()
+float PSSM::score_for_pvalue(double pvalue) const
 {
-    const size_t ncol = m_score_matrix[0].size();
-
-    // get m_reverse_matrix to a proper size
-    m_reverse_matrix.resize(m_motif_len);
-    for (auto &row : m_reverse_matrix)
+    // Scores rounded to multiples of PVALUE_STEP, by position
+    vector<long> steps(4 * m_motif_len);
+    long low = 0;
+    for (size_t i = 0; i < 4 * m_motif_len; i++)
     {
-        row.resize(ncol);
+        steps[i] = std::lround(m_score_matrix[i] / PVALUE_STEP);
     }
-
-    // A <-> T and C <-> G
-    for (size_t i = 0; i < m_motif_len; i++)
+    // Distribution of the rounded score of a window of bases drawn from the
+    // background: after position p, dist[j] is the probability that the
+    // first p rounded scores sum to low + j steps
+    vector<double> dist(1, 1.0), next;
+    for (size_t p = 0; p < m_motif_len; p++)
     {
-        for (unsigned j = 0; j < ncol; j++)
+        const long *row = &steps[4 * p];
+        const long least = *std::min_element(row, row + 4), most = *std::max_element(row, row + 4);
+        low += least;
+        next.assign(dist.size() + (most - least), 0.0);
+        for (size_t j = 0; j < dist.size(); j++)
         {
-            m_reverse_matrix[m_motif_len - i - 1][j] = m_score_matrix[i][ncol - j - 1];
+            if (dist[j] == 0)
+            {
+                continue;
+            }
+            for (size_t k = 0; k < 4; k++)
+            {
+                next[j + (row[k] - least)] += dist[j] * m_background_prob[k];
+            }
         }
+        dist.swap(next);
+    }
+
+    // Smallest sum whose upper tail is within pvalue
+    double tail = 0;
+    size_t t = dist.size();
+    while (t > 0 && tail + dist[t - 1] <= pvalue)
+    {
+        tail += dist[--t];
     }
+    // A window scoring s sums to within motif_len / 2 steps of s / PVALUE_STEP,
+    // so every window reaching this score sums to t or more
+    return (low + static_cast<long>(t) + m_motif_len / 2.0) * PVALUE_STEP;
 }
 
-float PSSM::calc_score_for_forward(const std::string &s, size_t istart)
+void PSSM::generate_reverse_matrix()
 {
-    float total_score = 0.0;
+    // A <-> T and C <-> G
+    m_reverse_matrix.resize(4 * m_motif_len);
     for (size_t i = 0; i < m_motif_len; i++)
     {
-        switch (s[i + istart])
+        for (unsigned j = 0; j < 4; j++)
         {
-        case 'A':
-            total_score += m_score_matrix[i][0];
-            break;
-        case 'C':
-            total_score += m_score_matrix[i][1];
-            break;
-        case 'G':
-            total_score += m_score_matrix[i][2];
-            break;
-        case 'T':
-            total_score += m_score_matrix[i][3];
-            break;
-
-        default:
-            break;
-        };
+            m_reverse_matrix[4 * (m_motif_len - i - 1) + j] = m_score_matrix[4 * i + 3 - j];
+        }
     }
-    return total_score;
 }
 
-float PSSM::calc_score_for_reverse(const std::string &s, size_t istart)
+float PSSM::calc_score_for_forward(const std::string &s, size_t istart)
 {
     float total_score = 0.0;
     for (size_t i = 0; i < m_motif_len; i++)
@@ -224,16 +258,16 @@ float PSSM::calc_score_for_reverse(const std::string &s, size_t istart)
         switch (s[i + istart])
         {
         case 'A':
-            total_score += m_reverse_matrix[i][0];
+            total_score += m_score_matrix[4 * i + 0];
             break;
         case 'C':
-            total_score += m_reverse_matrix[i][1];
+            total_score += m_score_matrix[4 * i + 1];
             break;
         case 'G':
-            total_score += m_reverse_matrix[i][2];
+            total_score += m_score_matrix[4 * i + 2];
             break;
         case 'T':
-            total_score += m_reverse_matrix[i][3];
+            total_score += m_score_matrix[4 * i + 3];
             break;
 
         default:
@@ -243,7 +277,7 @@ float PSSM::calc_score_for_reverse(const std::string &s, size_t istart)
     return total_score;
 }
 
-string PSSM::generate_reverse_strand(const std::string &s)
+string PSSM::generate_reverse_strand(const std::string &s) const
 {
     const size_t s_size = s.size() - 1;
     string ans(s_size + 1, 'x');
@@ -7,29 +7,56 @@
 #include <vector>
 #include <cmath>
 #include <cassert>
+#include <functional>
 
 using Svec = std::vector<std::string>;
-template <typename T>
-using Matrix = std::vector<std::vector<T>>;
+
+// A fasta record, with its bases coded 0-3
+struct Record
+{
+  std::string name;
+  std::string codes;
+};
 
 namespace preprocess
 {
 Svec read_motifs(const std::string &s);     // flat file
-std::string read_DNA(const std::string &s); // fasta file
-void normalize_sequence(std::string &s);
+std::vector<Record> read_records(const std::string &s); // fasta file, as codes 0-3
+std::string decode_DNA(const std::string &codes, size_t i, size_t len);
+// of A, C, G, T over the records; also counts their bases
+std::vector<float> background_prob(const std::vector<Record> &records, size_t &DNA_len);
+// the same over a fasta file, streamed (stream.cpp); also counts its records
+std::vector<float> background_prob(const std::string &DNA_path, size_t &records, size_t &DNA_len);
+// whether the file can be read a second time (a regular file, not a pipe)
+bool rereadable(const std::string &path);
+Svec read_library(const std::string &s); // motif file names, one per line
 void to_upper_case(std::string &s);
 } // namespace preprocess
 
+// A window scoring at least the cutoff, on the direct ('+') or the
+// complementary ('-') strand; formatted only when printed
+struct Hit
+{
+  size_t start;   // from 0
+  unsigned motif; // index in the library
+  char strand;
+  float score;
+};
+
+// Resolution of the score distribution behind PSSM::score_for_pvalue
+const double PVALUE_STEP = 0.001;
+
 class PSSM
 {
 private:
   size_t m_motif_len;
-  Matrix<float> m_score_matrix; // columns A, C, G, T
-  Matrix<float> m_reverse_matrix;
+  // motif_len x 4, row-major: position i, base k (A, C, G, T) at [4 * i + k]
+  std::vector<float> m_score_matrix;
+  std::vector<float> m_reverse_matrix;
   std::vector<float> m_background_prob;
 
 public:
-  PSSM(const Svec &motifs, const std::string &DNA);
+  PSSM(const Svec &motifs, const std::vector<float> &background_prob);
   std::vector<float> count_char_occurrence(const std::string &s);
   void print_score_matrix(const unsigned rounding);
   void construct_freq_matrix(const Svec &v);
@@ -37,6 +64,38 @@ public:
   void convert_to_score_matrix();
   void generate_reverse_matrix();
   float calc_score_for_forward(const std::string &s, size_t i);
-  float calc_score_for_reverse(const std::string &s, size_t i);
-  std::string generate_reverse_strand(const std::string &s);
+  std::string generate_reverse_strand(const std::string &s) const;
+  // Lowest score whose windows, of bases drawn from the background, score as
+  // high with probability at most `pvalue`: exact on scores rounded to
+  // multiples of PVALUE_STEP, and above the true one by at most
+  // motif_len * PVALUE_STEP / 2
+  float score_for_pvalue(double pvalue) const;
+  // Scores of the windows starting at `begin` to `end` - 1 of a genome coded
+  // 0-3, on the direct and on the complementary strand (scan.cpp)
+  void scan(const std::string &codes, size_t begin, size_t end,
+            std::vector<float> &forward, std::vector<float> &reverse) const;
+  // The same windows scoring at least `min_score`, appended to `hits` as
+  // motif `motif`: by start, those of the direct strand first. Windows are
+  // abandoned as soon as they cannot reach it (branch and bound).
+  void scan_hits(const std::string &codes, size_t begin, size_t end, float min_score,
+                 unsigned motif, std::vector<Hit> &hits) const;
+  size_t motif_len() const { return m_motif_len; }
 };
+
+// Hits of a library of PSSMs, each with its own cutoff, in one pass over the
+// genome: by start, then motif, then strand (scan.cpp)
+std::vector<Hit> find_hits(const std::vector<const PSSM *> &library,
+                           const std::vector<float> &min_scores,
+                           const std::string &codes);
+
+// Receives the hits of one chunk of a record, with starts from 0 in the
+// chunk, whose codes begin at `offset` in the record
+using HitReport = std::function<void(const std::string &record, const std::string &codes,
+                                     size_t offset, const std::vector<Hit> &hits)>;
+
+// find_hits over every record of a fasta file, in chunks of `chunk_size`
+// bases that overlap by the longest motif length - 1, so that memory does
+// not grow with the genome; the next chunk is read while one is scanned.
+// `report` gets the chunks in file order (stream.cpp).
+void scan_fasta(const std::string &DNA_path, const std::vector<const PSSM *> &library,
+                const std::vector<float> &min_scores, size_t chunk_size, const HitReport &report);
@@ -0,0 +1,557 @@
+#include "pssm.h"
+#include <algorithm> // std::max, std::max_element, std::min, std::stable_sort
+#include <cstdint>   // int16_t, int32_t, uint16_t, uint64_t
+#include <cstring>   // std::memcpy
+#include <immintrin.h> // _mm256_shuffle_epi8, _mm_shuffle_epi8
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// GCC vector extension type holding `BYTES / sizeof(T)` lanes of T
+template <typename T, size_t BYTES>
+struct Vec
+{
+    typedef T type __attribute__((vector_size(BYTES)));
+};
+
+// Whether any lane of a comparison result is set
+template <typename V>
+inline bool any(const V &mask)
+{
+    uint64_t words[sizeof(V) / sizeof(uint64_t)];
+    std::memcpy(words, &mask, sizeof(V));
+    uint64_t ans = 0;
+    for (const uint64_t w : words)
+    {
+        ans |= w;
+    }
+    return ans != 0;
+}
+
+// Branch and bound on one strand: the motif positions by decreasing
+// information content, and bound[k], the most that positions order[k] to
+// order[len - 1] can still add to a window, plus `margin`. The margin covers
+// the rounding of adding the positions in that order instead of the original
+// one, so a window is only rejected if its exact score is below the cutoff.
+struct Lookahead
+{
+    vector<size_t> order;
+    vector<float> bound;
+    float margin;
+};
+
+// Positions added before the bound check: past them, well under 1% of the
+// windows are still in the running on the bundled motifs
+const size_t HEAD = 8;
+
+Lookahead lookahead(const float *table, size_t len, const vector<float> &information)
+{
+    Lookahead ans{vector<size_t>(len), vector<float>(len + 1), 0};
+    float magnitude = 0;
+    for (size_t p = 0; p < len; p++)
+    {
+        ans.order[p] = p;
+        for (size_t k = 0; k < 4; k++)
+        {
+            magnitude = std::max(magnitude, std::fabs(table[4 * p + k]));
+        }
+    }
+    std::stable_sort(ans.order.begin(), ans.order.end(), [&](size_t a, size_t b) {
+        return information[a] > information[b];
+    });
+    // each of the ~2 len roundings is within 2^-24 of the largest partial sum
+    ans.margin = len * len * magnitude / (1 << 20);
+    ans.bound[len] = ans.margin;
+    for (size_t k = len; k-- > 0;)
+    {
+        const float *row = table + 4 * ans.order[k];
+        ans.bound[k] = ans.bound[k + 1] + *std::max_element(row, row + 4);
+    }
+    return ans;
+}
+
+// Where the scan of a strand puts its windows: every score, or given a
+// cutoff, the hits only
+struct Sink
+{
+  float *scores;
+  vector<Hit> *hits;
+  size_t begin; // genome position of window 0
+  unsigned motif;
+  char strand;
+};
+
+// Score of the window at i, adding the positions in order
+template <typename Base>
+inline float window_score(const Base *bases, size_t i, size_t len, const float *table)
+{
+    float ans = 0.0;
+    for (size_t p = 0; p < len; p++)
+    {
+        ans += table[4 * p + bases[i + p]];
+    }
+    return ans;
+}
+
+// Score the window at i in order, and keep it if it reaches `min_score`
+template <typename Base>
+inline void offer(const Base *bases, size_t i, size_t len, const float *table,
+                  float min_score, const Sink &sink)
+{
+    const float score = window_score(bases, i, len, table);
+    if (score >= min_score)
+    {
+        sink.hits->push_back({sink.begin + i, sink.motif, sink.strand, score});
+    }
+}
+
+// Score U vectors of consecutive windows of `bases`, from the window at i.
+// At motif position p, lane w reads the base of its window, bases[i + w + p],
+// and picks its score out of row p of the table with a variable shuffle.
+// The vectors are independent, so their adds hide each other's latency.
+// Without FILTER, each lane adds the positions in order, as the scalar
+// scanner does, so the scores are the same to the bit. With FILTER, the rows
+// are in lookahead order and a vector stops after the first HEAD positions
+// unless one of its windows can still reach `min_score`; if so, it adds the
+// others, and the windows that can reach it are rescored in order.
+template <size_t BYTES, bool FILTER, size_t U>
+inline __attribute__((always_inline)) void scan_vectors(
+    const int32_t *bases, size_t i, size_t len, const float *rows,
+    const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    typedef typename Vec<float, BYTES>::type Floats;
+    typedef typename Vec<int32_t, BYTES>::type Ints;
+    const size_t W = BYTES / sizeof(float), head = FILTER ? std::min(len, HEAD) : len;
+    auto add = [&](Floats &acc, size_t first, size_t k) {
+        Floats row;
+        Ints b;
+        std::memcpy(&row, rows + k * W, sizeof(row));
+        std::memcpy(&b, bases + first + (FILTER ? ahead.order[k] : k), sizeof(b));
+        acc += __builtin_shuffle(row, b);
+    };
+    Floats acc[U] = {};
+    for (size_t k = 0; k < head; k++)
+    {
+        for (size_t u = 0; u < U; u++)
+        {
+            add(acc[u], i + u * W, k);
+        }
+    }
+    for (size_t u = 0; u < U; u++)
+    {
+        const size_t first = i + u * W;
+        if (!FILTER)
+        {
+            std::memcpy(sink.scores + first, &acc[u], sizeof(acc[u]));
+            continue;
+        }
+        if (!any(acc[u] + ahead.bound[head] >= min_score))
+        {
+            continue;
+        }
+        for (size_t k = head; k < len; k++)
+        {
+            add(acc[u], first, k);
+        }
+        for (size_t w = 0; w < W; w++)
+        {
+            if (acc[u][w] + ahead.margin >= min_score)
+            {
+                offer(bases, first + w, len, table, min_score, sink);
+            }
+        }
+    }
+}
+
+// Score the windows 0 to `n` - 1 of `bases` on one strand
+template <size_t BYTES, bool FILTER>
+inline __attribute__((always_inline)) void scan_kernel(
+    const int32_t *bases, size_t n, size_t len,
+    const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    const size_t W = BYTES / sizeof(float), U = 4;
+    // the table rows in scanning order, each repeated across a vector (loaded
+    // with memcpy: std::vector does not honour the alignment of vector types)
+    vector<float> rows(len * W);
+    for (size_t k = 0; k < len; k++)
+    {
+        for (size_t w = 0; w < W; w++)
+        {
+            rows[k * W + w] = table[4 * (FILTER ? ahead.order[k] : k) + w % 4];
+        }
+    }
+    size_t i = 0;
+    for (; i + U * W <= n; i += U * W)
+    {
+        scan_vectors<BYTES, FILTER, U>(bases, i, len, rows.data(), table, ahead, min_score, sink);
+    }
+    for (; i + W <= n; i += W)
+    {
+        scan_vectors<BYTES, FILTER, 1>(bases, i, len, rows.data(), table, ahead, min_score, sink);
+    }
+    for (; i < n; i++)
+    {
+        if (FILTER)
+        {
+            offer(bases, i, len, table, min_score, sink);
+        }
+        else
+        {
+            sink.scores[i] = window_score(bases, i, len, table);
+        }
+    }
+}
+
+template <bool FILTER>
+__attribute__((target("avx2"))) void scan_avx2(
+    const int32_t *bases, size_t n, size_t len,
+    const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    scan_kernel<32, FILTER>(bases, n, len, table, ahead, min_score, sink);
+}
+template <bool FILTER>
+__attribute__((target("sse4.1"))) void scan_sse41(
+    const int32_t *bases, size_t n, size_t len,
+    const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    scan_kernel<16, FILTER>(bases, n, len, table, ahead, min_score, sink);
+}
+template <bool FILTER>
+void scan_generic(
+    const int32_t *bases, size_t n, size_t len,
+    const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    scan_kernel<16, FILTER>(bases, n, len, table, ahead, min_score, sink);
+}
+
+template <bool FILTER>
+void scan_strand(const int32_t *bases, size_t n, size_t len,
+                 const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan_avx2<FILTER>(bases, n, len, table, ahead, min_score, sink);
+    }
+    else if (__builtin_cpu_supports("sse4.1"))
+    {
+        scan_sse41<FILTER>(bases, n, len, table, ahead, min_score, sink);
+    }
+    else
+    {
+        scan_generic<FILTER>(bases, n, len, table, ahead, min_score, sink);
+    }
+}
+
+// The table of one strand for the quantized scan: the scores of position
+// order[k] in row k, scaled to int16 and rounded, and bound[k], the most
+// rows k to len - 1 can add. Each rounding is within 1/2, so a window sums
+// to within len / 2 of its scaled score, and one reaching the cutoff sums to
+// at least `threshold`.
+struct Quantized
+{
+    vector<int16_t> rows; // len x 4
+    vector<int16_t> bound;
+    int16_t threshold;
+};
+
+// Largest scaled sum of the best (or worst) score of every position, so
+// that sums and bounds add up within int16
+const double QUANTIZED_RANGE = 1 << 13;
+
+// Positions the quantized scan adds before the bound check
+const size_t QUANTIZED_HEAD = 8;
+
+Quantized quantize(const float *table, size_t len, const Lookahead &ahead, float min_score)
+{
+    double magnitude = 0;
+    for (size_t p = 0; p < len; p++)
+    {
+        double largest = 0;
+        for (size_t k = 0; k < 4; k++)
+        {
+            largest = std::max(largest, std::fabs(static_cast<double>(table[4 * p + k])));
+        }
+        magnitude += largest;
+    }
+    const double scale = QUANTIZED_RANGE / std::max(magnitude, 1e-30);
+    Quantized ans{vector<int16_t>(4 * len), vector<int16_t>(len + 1, 0), 0};
+    for (size_t k = len; k-- > 0;)
+    {
+        int16_t best = INT16_MIN;
+        for (size_t b = 0; b < 4; b++)
+        {
+            const int16_t q = std::lround(table[4 * ahead.order[k] + b] * scale);
+            ans.rows[4 * k + b] = q;
+            best = std::max(best, q);
+        }
+        ans.bound[k] = ans.bound[k + 1] + best;
+    }
+    // the float score of a window is within ahead.margin of its exact sum;
+    // one less for the rounding of this bound itself
+    const double least = std::floor((min_score - ahead.margin) * scale - len / 2.0) - 1;
+    ans.threshold = std::max<double>(INT16_MIN, std::min<double>(INT16_MAX, least));
+    return ans;
+}
+
+// Byte lookup within each 16-byte lane (pshufb): byte j of `out` is byte
+// index[j] of the lane of `row` it sits in. These are only inlined in
+// functions of their target, so the kernels calling them are flattened.
+__attribute__((target("avx2"))) inline void lookup(
+    const Vec<char, 32>::type &row, const Vec<char, 32>::type &index, Vec<char, 32>::type &out)
+{
+    out = (Vec<char, 32>::type)_mm256_shuffle_epi8((__m256i)row, (__m256i)index);
+}
+__attribute__((target("ssse3"))) inline void lookup(
+    const Vec<char, 16>::type &row, const Vec<char, 16>::type &index, Vec<char, 16>::type &out)
+{
+    out = (Vec<char, 16>::type)_mm_shuffle_epi8((__m128i)row, (__m128i)index);
+}
+
+// Filter U vectors of windows in int16 lanes, from the window at i, as
+// scan_vectors does with FILTER. The base of lane w at a position is the
+// pair of byte indices of its int16 score in a table row, so that one byte
+// lookup picks a score for twice as many windows as a float shuffle. Lanes
+// that can reach the threshold are rescored in float, in order.
+template <size_t BYTES, size_t U>
+inline __attribute__((always_inline)) void quantized_vectors(
+    const uint16_t *pairs, const char *bases, size_t i, size_t len, const int16_t *rows,
+    const Quantized &quantized, const float *table, const Lookahead &ahead,
+    float min_score, const Sink &sink)
+{
+    typedef typename Vec<int16_t, BYTES>::type Shorts;
+    typedef typename Vec<char, BYTES>::type Bytes;
+    const size_t W = BYTES / sizeof(int16_t), head = std::min(len, QUANTIZED_HEAD);
+    auto add = [&](Shorts &acc, size_t first, size_t k) {
+        Bytes row, index, scores;
+        std::memcpy(&row, rows + k * W, sizeof(row));
+        std::memcpy(&index, pairs + first + ahead.order[k], sizeof(index));
+        lookup(row, index, scores);
+        acc += (Shorts)scores;
+    };
+    Shorts acc[U] = {};
+    for (size_t k = 0; k < head; k++)
+    {
+        for (size_t u = 0; u < U; u++)
+        {
+            add(acc[u], i + u * W, k);
+        }
+    }
+    for (size_t u = 0; u < U; u++)
+    {
+        const size_t first = i + u * W;
+        if (!any(acc[u] + quantized.bound[head] >= quantized.threshold))
+        {
+            continue;
+        }
+        for (size_t k = head; k < len; k++)
+        {
+            add(acc[u], first, k);
+        }
+        for (size_t w = 0; w < W; w++)
+        {
+            if (acc[u][w] >= quantized.threshold)
+            {
+                offer(bases, first + w, len, table, min_score, sink);
+            }
+        }
+    }
+}
+
+// The hits among windows 0 to `n` - 1 on one strand, quantized
+template <size_t BYTES>
+inline __attribute__((always_inline)) void quantized_kernel(
+    const uint16_t *pairs, const char *bases, size_t n, size_t len,
+    const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    const size_t W = BYTES / sizeof(int16_t), U = 4;
+    const Quantized quantized = quantize(table, len, ahead, min_score);
+    vector<int16_t> rows(len * W);
+    for (size_t k = 0; k < len; k++)
+    {
+        for (size_t w = 0; w < W; w++)
+        {
+            rows[k * W + w] = quantized.rows[4 * k + w % 4];
+        }
+    }
+    size_t i = 0;
+    for (; i + U * W <= n; i += U * W)
+    {
+        quantized_vectors<BYTES, U>(pairs, bases, i, len, rows.data(), quantized, table, ahead, min_score, sink);
+    }
+    for (; i + W <= n; i += W)
+    {
+        quantized_vectors<BYTES, 1>(pairs, bases, i, len, rows.data(), quantized, table, ahead, min_score, sink);
+    }
+    for (; i < n; i++)
+    {
+        offer(bases, i, len, table, min_score, sink);
+    }
+}
+
+__attribute__((target("avx2"), flatten)) void quantized_avx2(
+    const uint16_t *pairs, const char *bases, size_t n, size_t len,
+    const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    quantized_kernel<32>(pairs, bases, n, len, table, ahead, min_score, sink);
+}
+__attribute__((target("sse4.1"), flatten)) void quantized_sse41(
+    const uint16_t *pairs, const char *bases, size_t n, size_t len,
+    const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    quantized_kernel<16>(pairs, bases, n, len, table, ahead, min_score, sink);
+}
+
+// The quantized scan needs a byte lookup
+bool quantized_supported()
+{
+    return __builtin_cpu_supports("avx2") || __builtin_cpu_supports("sse4.1");
+}
+
+void quantized_strand(const uint16_t *pairs, const char *bases, size_t n, size_t len,
+                      const float *table, const Lookahead &ahead, float min_score, const Sink &sink)
+{
+    if (__builtin_cpu_supports("avx2"))
+    {
+        quantized_avx2(pairs, bases, n, len, table, ahead, min_score, sink);
+    }
+    else
+    {
+        quantized_sse41(pairs, bases, n, len, table, ahead, min_score, sink);
+    }
+}
+
+// The bases of windows `begin` to `end` - 1 as the byte indices 2 b and
+// 2 b + 1 of their int16 score in a table row, for both strands
+vector<uint16_t> lane_pairs(const string &codes, size_t begin, size_t end, size_t len)
+{
+    assert(begin <= end && end + len <= codes.size() + 1);
+    vector<uint16_t> ans(end - begin + len - 1);
+    for (size_t i = 0; i < ans.size(); i++)
+    {
+        const uint16_t b = static_cast<unsigned char>(codes[begin + i]);
+        ans[i] = (2 * b) | ((2 * b + 1) << 8);
+    }
+    return ans;
+}
+
+// The bases of windows `begin` to `end` - 1, widened once to lane size for
+// both strands
+vector<int32_t> widen(const string &codes, size_t begin, size_t end, size_t len)
+{
+    assert(begin <= end && end + len <= codes.size() + 1);
+    vector<int32_t> ans(end - begin + len - 1);
+    for (size_t i = 0; i < ans.size(); i++)
+    {
+        ans[i] = static_cast<unsigned char>(codes[begin + i]);
+    }
+    return ans;
+}
+} // namespace
+
+void PSSM::scan(const string &codes, size_t begin, size_t end,
+                vector<float> &forward, vector<float> &reverse) const
+{
+    assert(m_reverse_matrix.size() == m_score_matrix.size());
+    const vector<int32_t> bases = widen(codes, begin, end, m_motif_len);
+    forward.resize(end - begin);
+    reverse.resize(end - begin);
+    const Lookahead none{};
+    scan_strand<false>(bases.data(), end - begin, m_motif_len, m_score_matrix.data(), none, 0,
+                       Sink{forward.data(), nullptr, begin, 0, '+'});
+    scan_strand<false>(bases.data(), end - begin, m_motif_len, m_reverse_matrix.data(), none, 0,
+                       Sink{reverse.data(), nullptr, begin, 0, '-'});
+}
+
+void PSSM::scan_hits(const string &codes, size_t begin, size_t end, float min_score,
+                     unsigned motif, vector<Hit> &hits) const
+{
+    assert(m_reverse_matrix.size() == m_score_matrix.size());
+    // Information content of each position, sum of f log2(f / background)
+    // over the bases, with the frequencies f recovered from the scores; the
+    // complementary strand reads the positions backwards.
+    vector<float> information(m_motif_len, 0);
+    for (size_t p = 0; p < m_motif_len; p++)
+    {
+        for (size_t k = 0; k < 4; k++)
+        {
+            const float score = m_score_matrix[4 * p + k];
+            information[p] += m_background_prob[k] * std::exp2(score) * score;
+        }
+    }
+    const vector<float> reverse_information(information.rbegin(), information.rend());
+    const float *tables[2] = {m_score_matrix.data(), m_reverse_matrix.data()};
+    const Lookahead ahead[2] = {lookahead(tables[0], m_motif_len, information),
+                                lookahead(tables[1], m_motif_len, reverse_information)};
+    const Sink sinks[2] = {Sink{nullptr, &hits, begin, motif, '+'},
+                           Sink{nullptr, &hits, begin, motif, '-'}};
+    if (quantized_supported())
+    {
+        const vector<uint16_t> pairs = lane_pairs(codes, begin, end, m_motif_len);
+        for (size_t s = 0; s < 2; s++)
+        {
+            quantized_strand(pairs.data(), codes.data() + begin, end - begin, m_motif_len,
+                             tables[s], ahead[s], min_score, sinks[s]);
+        }
+        return;
+    }
+    const vector<int32_t> bases = widen(codes, begin, end, m_motif_len);
+    for (size_t s = 0; s < 2; s++)
+    {
+        scan_strand<true>(bases.data(), end - begin, m_motif_len, tables[s], ahead[s], min_score, sinks[s]);
+    }
+}
+
+vector<Hit> find_hits(const vector<const PSSM *> &library,
+                      const vector<float> &min_scores,
+                      const string &codes)
+{
+    assert(library.size() == min_scores.size());
+    // Every motif scans a block of windows while its bases are in cache.
+    // Each block collects its hits in its own buffer, so threads share
+    // nothing while scanning and the buffers join in genome order.
+    const size_t BLOCK = 1 << 14;
+    size_t min_len = codes.size() + 1;
+    for (const auto *pssm : library)
+    {
+        min_len = std::min(min_len, pssm->motif_len());
+    }
+    if (library.empty() || codes.size() < min_len)
+    {
+        return {};
+    }
+    const size_t block_num = (codes.size() - min_len + BLOCK) / BLOCK;
+    vector<vector<Hit>> block_hits(block_num);
+#pragma omp parallel for schedule(dynamic)
+    for (size_t b = 0; b < block_num; b++)
+    {
+        vector<Hit> &hits = block_hits[b];
+        for (unsigned m = 0; m < library.size(); m++)
+        {
+            const size_t len = library[m]->motif_len(), begin = b * BLOCK;
+            if (codes.size() < len || begin > codes.size() - len)
+            {
+                continue;
+            }
+            const size_t end = std::min(codes.size() - len + 1, begin + BLOCK);
+            library[m]->scan_hits(codes, begin, end, min_scores[m], m, hits);
+        }
+        // by start, then motif; '+' hits come first, and stay before '-'
+        std::stable_sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b) {
+            return (a.start != b.start) ? a.start < b.start : a.motif < b.motif;
+        });
+    }
+    size_t hit_num = 0;
+    for (const auto &hits : block_hits)
+    {
+        hit_num += hits.size();
+    }
+    vector<Hit> ans;
+    ans.reserve(hit_num);
+    for (const auto &hits : block_hits)
+    {
+        ans.insert(ans.end(), hits.begin(), hits.end());
+    }
+    return ans;
+}
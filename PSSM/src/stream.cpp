@@ -0,0 +1,134 @@
+#include "pssm.h"
+#include "fasta.h"
+#include <algorithm>
+#include <future>
+#include <sys/stat.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+// A piece of a record: its bases coded 0-3, from `offset` in the record.
+// Windows starting from `owned` on are left to the next piece, which repeats
+// the bases they need.
+struct Chunk
+{
+  string record;
+  string codes;
+  size_t offset = 0, owned = 0;
+};
+
+// Cuts the records of a FASTA file into chunks of about `size` new bases,
+// each starting with the last `overlap` bases of the one before in the same
+// record, so that every window lies whole in one of them
+class Chunker
+{
+private:
+  fasta::Reader m_reader;
+  size_t m_size, m_overlap;
+  string m_record, m_tail;
+  size_t m_offset = 0;      // in the record, of the next chunk
+  bool m_in_record = false; // false when the next chunk starts a record
+
+public:
+  Chunker(const string &path, size_t size, size_t overlap)
+      : m_reader(path, fasta::Alphabet::dna_codes), m_size(size), m_overlap(overlap) {}
+
+  // Fill `chunk`, reusing its memory; false at the end of the file
+  bool next(Chunk &chunk)
+  {
+    if (!m_in_record)
+    {
+      if (!m_reader.start(m_record))
+      {
+        return false;
+      }
+      m_tail.clear();
+      m_offset = 0;
+      m_in_record = true;
+    }
+    chunk.codes.assign(m_tail);
+    chunk.record = m_record;
+    chunk.offset = m_offset;
+    const size_t added = m_reader.read(chunk.codes, m_size);
+    // a full chunk may be followed by more of the record, which then owns
+    // the windows that reach into the overlap
+    m_in_record = (added == m_size);
+    chunk.owned = (m_in_record && chunk.codes.size() > m_overlap)
+                      ? chunk.codes.size() - m_overlap
+                      : chunk.codes.size();
+    m_offset += chunk.owned;
+    m_tail.assign(chunk.codes, chunk.owned, string::npos);
+    return true;
+  }
+
+  void report() const { m_reader.report(); }
+};
+} // namespace
+
+namespace preprocess
+{
+vector<float> background_prob(const string &DNA_path, size_t &records, size_t &DNA_len)
+{
+    // counted in integers: a float count stops growing at 2^24
+    fasta::Reader reader(DNA_path, fasta::Alphabet::dna_codes);
+    size_t counts[4] = {0, 0, 0, 0};
+    string name, codes;
+    records = 0;
+    while (reader.start(name))
+    {
+        records++;
+        while (reader.read(codes, 1 << 20) > 0)
+        {
+            for (const char c : codes)
+            {
+                counts[static_cast<unsigned char>(c)]++;
+            }
+            codes.clear();
+        }
+    }
+    DNA_len = counts[0] + counts[1] + counts[2] + counts[3];
+    vector<float> ans(4, 0);
+    for (size_t k = 0; k < 4 && DNA_len > 0; k++)
+    {
+        ans[k] = static_cast<float>(counts[k]) / DNA_len;
+    }
+    return ans;
+}
+
+bool rereadable(const string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+} // namespace preprocess
+
+void scan_fasta(const string &DNA_path, const vector<const PSSM *> &library,
+                const vector<float> &min_scores, size_t chunk_size, const HitReport &report)
+{
+    assert(!library.empty() && library.size() == min_scores.size());
+    size_t overlap = 0;
+    for (const PSSM *pssm : library)
+    {
+        overlap = std::max(overlap, pssm->motif_len() - 1);
+    }
+    Chunker chunker(DNA_path, std::max(chunk_size, overlap + 1), overlap);
+
+    // two chunks: the next one is read while this one is scanned
+    Chunk chunks[2];
+    bool more = chunker.next(chunks[0]);
+    for (size_t c = 0; more; c ^= 1)
+    {
+        const Chunk &chunk = chunks[c];
+        auto reading = std::async(std::launch::async, [&] { return chunker.next(chunks[c ^ 1]); });
+        vector<Hit> hits = find_hits(library, min_scores, chunk.codes);
+        hits.erase(std::remove_if(hits.begin(), hits.end(), [&](const Hit &hit) {
+                       return hit.start >= chunk.owned;
+                   }),
+                   hits.end());
+        report(chunk.record, chunk.codes, chunk.offset, hits);
+        more = reading.get();
+    }
+    chunker.report();
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include "genome.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Single-pass FASTA reader shared by the tools. The file is read in fixed
+// chunks and every byte of a sequence goes through one lookup table that
+// upper-cases it, drops what the alphabet does not keep and, for DNA codes,
+// maps it to 0-3. The raw text is never held in memory, so a genome only
+// takes the size of its normalized sequence; read in pieces with start() and
+// read(), a record takes no more than a piece. A genome container
+// (genome.h) is read the same way, without parsing: its bases are decoded
+// straight from the mapped file.
+namespace fasta
+{
+enum class Alphabet
+{
+  letters,  // A-Z, upper-cased
+  dna,      // A, C, G and T, upper-cased
+  dna_codes // A, C, G and T as 0, 1, 2 and 3
+};
+
+// Whether Reader::report prints; the tools turn it on with --verbose
+inline bool verbose = false;
+
+class Reader
+{
+private:
+  static constexpr size_t CHUNK = 1 << 20;
+  static constexpr char DROP = static_cast<char>(0xff);
+  std::string m_path, m_description;
+  FILE *m_file;
+  std::vector<char> m_buffer;
+  size_t m_pos = 0, m_end = 0, m_bytes = 0, m_records = 0, m_residues = 0;
+  bool m_in_record = false, m_line_start = true;
+  long m_size; // of the file, -1 if unknown (e.g. a pipe)
+  char m_table[256];
+  std::chrono::steady_clock::time_point m_start;
+  // reading a container instead: the record being read and where in it
+  std::unique_ptr<genome::Container> m_genome;
+  const genome::Entry *m_entry = nullptr;
+  size_t m_next = 0, m_base = 0, m_run = 0;
+  char m_codes[4];       // the letters A, C, G, T through the table
+  char m_quads[256][4];  // the 4 bases of a packed byte, the same way
+
+  // make sure the buffer has unread bytes; false at the end of the file
+  bool fill()
+  {
+    if (m_pos == m_end)
+    {
+      m_end = fread(m_buffer.data(), 1, CHUNK, m_file);
+      m_pos = 0;
+      m_bytes += m_end;
+    }
+    return m_pos < m_end;
+  }
+
+  // read() on a container: masked bases are N, which the alphabet keeps or
+  // drops as it would in a FASTA file
+  size_t read_packed(std::string &sequence, size_t max)
+  {
+    const size_t begin = sequence.size();
+    const char masked = m_table[static_cast<unsigned char>('N')];
+    while (m_in_record && m_base < m_entry->length && sequence.size() - begin < max)
+    {
+      const size_t room = max - (sequence.size() - begin);
+      const genome::Run *run = (m_run < m_entry->run_num) ? &m_genome->run(*m_entry, m_run) : nullptr;
+      if (run != nullptr && m_base >= run->start)
+      {
+        size_t stop = run->start + run->length;
+        if (masked != DROP)
+        {
+          stop = m_base + std::min(stop - m_base, room);
+          sequence.append(stop - m_base, masked);
+        }
+        m_base = stop;
+        m_run += (m_base == run->start + run->length);
+        continue;
+      }
+      const size_t stop = m_base + std::min(((run != nullptr) ? run->start : m_entry->length) - m_base, room);
+      const size_t old = sequence.size();
+      sequence.resize(old + (stop - m_base));
+      char *out = &sequence[old];
+      const unsigned char *packed = m_genome->bases(*m_entry);
+      size_t j = m_base;
+      for (; j < stop && j % 4 != 0; j++)
+      {
+        *out++ = m_codes[m_genome->code(*m_entry, j)];
+      }
+      for (; j + 4 <= stop; j += 4, out += 4)
+      {
+        memcpy(out, m_quads[packed[j / 4]], 4);
+      }
+      for (; j < stop; j++)
+      {
+        *out++ = m_codes[m_genome->code(*m_entry, j)];
+      }
+      m_base = stop;
+    }
+    if (m_in_record && m_base == m_entry->length)
+    {
+      m_in_record = false;
+    }
+    m_residues += sequence.size() - begin;
+    return sequence.size() - begin;
+  }
+
+public:
+  Reader(const std::string &path, Alphabet alphabet)
+      : m_path(path), m_file(fopen(path.c_str(), "rb")), m_buffer(CHUNK),
+        m_start(std::chrono::steady_clock::now())
+  {
+    if (m_file == nullptr)
+    {
+      printf("Cannot open file: %s\n", path.c_str());
+      exit(1);
+    }
+    m_size = (fseek(m_file, 0, SEEK_END) == 0) ? ftell(m_file) : -1;
+    if (m_size < 0 || fseek(m_file, 0, SEEK_SET) != 0)
+    {
+      m_size = -1;
+    }
+    const char dna[] = "ACGT";
+    for (int c = 0; c < 256; c++)
+    {
+      const char upper = (c >= 'a' && c <= 'z') ? c - 32 : c;
+      m_table[c] = DROP;
+      if (alphabet == Alphabet::letters && upper >= 'A' && upper <= 'Z')
+      {
+        m_table[c] = upper;
+      }
+      for (int k = 0; k < 4 && alphabet != Alphabet::letters; k++)
+      {
+        if (upper == dna[k])
+        {
+          m_table[c] = (alphabet == Alphabet::dna) ? upper : static_cast<char>(k);
+        }
+      }
+    }
+    // the magic is read into the buffer, where the parser finds it if the
+    // file is FASTA: a pipe cannot be read twice
+    if (fill() && genome::has_magic(m_buffer.data(), m_end))
+    {
+      m_genome.reset(new genome::Container(path));
+      m_bytes = m_genome->bytes();
+      for (int k = 0; k < 4; k++)
+      {
+        m_codes[k] = m_table[static_cast<unsigned char>(dna[k])];
+      }
+      for (int byte = 0; byte < 256; byte++)
+      {
+        for (int k = 0; k < 4; k++)
+        {
+          m_quads[byte][k] = m_codes[(byte >> (2 * k)) & 3];
+        }
+      }
+    }
+  }
+  ~Reader() { fclose(m_file); }
+  Reader(const Reader &) = delete;
+  Reader &operator=(const Reader &) = delete;
+
+  // Move to the next record, skipping what is left of the current one, and
+  // read the first word of its description line. Text before the first '>'
+  // is a record without a name. Returns false at the end of the file.
+  bool start(std::string &name)
+  {
+    std::string rest;
+    while (m_in_record && read(rest, CHUNK))
+    {
+      rest.clear();
+    }
+    name.clear();
+    m_description.clear();
+    if (m_genome)
+    {
+      if (m_next == m_genome->size())
+      {
+        return false;
+      }
+      m_entry = &m_genome->entry(m_next++);
+      m_description = m_genome->name(*m_entry);
+      m_base = m_run = 0;
+    }
+    else if (!fill())
+    {
+      return false;
+    }
+    // a record starts right at its '>'
+    else if (m_buffer[m_pos] == '>')
+    {
+      m_pos++;
+      while (fill())
+      {
+        const char c = m_buffer[m_pos++];
+        if (c == '\n')
+        {
+          break;
+        }
+        if (c != '\r')
+        {
+          m_description += c;
+        }
+      }
+    }
+    const size_t first = m_description.find_first_not_of(" \t");
+    if (first != std::string::npos)
+    {
+      name.assign(m_description, first, m_description.find_first_of(" \t", first) - first);
+    }
+    m_in_record = true;
+    m_line_start = true;
+    m_records++;
+    return true;
+  }
+
+  // Append up to `max` more residues of the current record to `sequence`,
+  // normalized. Returns how many, 0 once the record is over.
+  size_t read(std::string &sequence, size_t max)
+  {
+    if (m_genome)
+    {
+      return read_packed(sequence, max);
+    }
+    const size_t begin = sequence.size();
+    while (m_in_record && sequence.size() - begin < max && fill())
+    {
+      // each byte gives at most one residue
+      const char *in = m_buffer.data() + m_pos,
+                 *const end = in + std::min<size_t>(m_end - m_pos, max - (sequence.size() - begin));
+      const size_t old = sequence.size();
+      sequence.resize(old + (end - in));
+      char *const base = &sequence[0], *out = base + old;
+      for (; in < end; in++)
+      {
+        const char c = *in;
+        if (c == '>' && m_line_start)
+        {
+          m_in_record = false;
+          break;
+        }
+        m_line_start = (c == '\n');
+        *out = m_table[static_cast<unsigned char>(c)];
+        out += (*out != DROP);
+      }
+      sequence.resize(out - base);
+      m_pos = in - m_buffer.data();
+    }
+    if (m_in_record && m_pos == m_end && !fill())
+    {
+      m_in_record = false;
+    }
+    m_residues += sequence.size() - begin;
+    return sequence.size() - begin;
+  }
+
+  // Read the next record: the first word of its description line, and its
+  // normalized sequence. Returns false at the end of the file.
+  bool next(std::string &name, std::string &sequence)
+  {
+    sequence.clear();
+    if (!start(name))
+    {
+      return false;
+    }
+    // The rest of the file bounds the sequence, so reserving it once saves
+    // the copies of growing the string (the spare capacity is not touched).
+    const long rest = m_genome ? static_cast<long>(m_entry->length)
+                               : m_size - static_cast<long>(m_bytes - (m_end - m_pos));
+    if ((m_genome || m_size >= 0) && sequence.capacity() < static_cast<size_t>(rest))
+    {
+      sequence.reserve(rest);
+    }
+    while (read(sequence, std::string::npos) > 0)
+    {
+    }
+    return true;
+  }
+
+  // The whole description line of the current record, without its '>'
+  const std::string &description() const { return m_description; }
+
+  // Records, residues and read speed so far, on stderr if `verbose`
+  void report() const
+  {
+    if (!verbose)
+    {
+      return;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count(),
+                 mb = m_bytes / 1048576.0;
+    fprintf(stderr, "Read %s: %zu record%s, %zu residue%s, %.1f MB in %.3f s (%.0f MB/s)\n",
+            m_path.c_str(), m_records, (m_records == 1) ? "" : "s", m_residues, (m_residues == 1) ? "" : "s",
+            mb, seconds, mb / seconds);
+  }
+};
+} // namespace fasta
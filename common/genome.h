@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary genome container, written by Genome_packer and opened by
+// fasta::Reader in place of a FASTA file. The file is mapped and read as is,
+// in the byte order of the machine that wrote it:
+//
+//     Header
+//     bases of every record, 2 bits each (A, C, G, T as 0-3), 4 to a byte
+//         from the low bits, each record starting on a byte
+//     Entry[record_num]        the record index
+//     Run[...]                 the masked runs of every record, in order
+//     names                    the description lines of the records, without
+//                              their '>', end to end
+//
+// Letters other than A, C, G and T (N, IUPAC codes) fall in masked runs,
+// whose bases are stored as A and read back as N.
+namespace genome
+{
+const char MAGIC[8] = {'Y', 'I', 'G', 'E', 'N', 'O', 'M', 'E'};
+const uint64_t VERSION = 1;
+
+struct Header
+{
+  char magic[8];
+  uint64_t version;
+  uint64_t record_num;
+  uint64_t index_offset; // of the Entry array
+  uint64_t runs_offset;  // of the Run array
+  uint64_t names_offset; // of the names
+};
+
+struct Entry
+{
+  uint64_t name_offset, name_size; // of the description line, in the names
+  uint64_t length;                 // bases, masked ones included
+  uint64_t bases_offset;           // in the file
+  uint64_t run_first, run_num;     // in the Run array
+};
+
+// Positions start to start + length - 1 of a record are masked
+struct Run
+{
+  uint64_t start, length;
+};
+
+// Whether `bytes` start with the container magic
+inline bool has_magic(const char *bytes, size_t size)
+{
+    return size >= sizeof(MAGIC) && memcmp(bytes, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+// Whether the file is a container. Only a regular file can be one: reading
+// the magic of a pipe would consume it.
+inline bool is_container(const std::string &path)
+{
+    char magic[sizeof(MAGIC)];
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        return false;
+    }
+    FILE *file = fopen(path.c_str(), "rb");
+    const bool ans = file != nullptr && has_magic(magic, fread(magic, 1, sizeof(magic), file));
+    if (file != nullptr)
+    {
+        fclose(file);
+    }
+    return ans;
+}
+
+// A container mapped read-only: opening it reads nothing but the header,
+// the pages of the bases are only loaded as they are decoded
+class Container
+{
+private:
+  const unsigned char *m_data = nullptr;
+  size_t m_size = 0;
+
+  // Whether every offset and count of the header and the index stays inside
+  // the mapped file, and the runs of each record are in order inside it, so
+  // that reading the records cannot run past the mapping
+  bool valid() const
+  {
+    const Header &h = header();
+    if (h.index_offset < sizeof(Header) || h.index_offset % alignof(Entry) != 0 ||
+        h.runs_offset % alignof(Run) != 0 || h.index_offset > h.runs_offset ||
+        h.runs_offset > h.names_offset || h.names_offset > m_size ||
+        h.record_num > (h.runs_offset - h.index_offset) / sizeof(Entry))
+    {
+      return false;
+    }
+    const uint64_t run_total = (h.names_offset - h.runs_offset) / sizeof(Run),
+                   names_size = m_size - h.names_offset;
+    for (size_t i = 0; i < h.record_num; i++)
+    {
+      const Entry &e = entry(i);
+      const uint64_t packed = e.length / 4 + (e.length % 4 != 0);
+      if (e.name_offset > names_size || e.name_size > names_size - e.name_offset ||
+          e.bases_offset < sizeof(Header) || e.bases_offset > h.index_offset ||
+          packed > h.index_offset - e.bases_offset ||
+          e.run_first > run_total || e.run_num > run_total - e.run_first)
+      {
+        return false;
+      }
+      uint64_t end = 0; // of the run before
+      for (size_t k = 0; k < e.run_num; k++)
+      {
+        const Run &r = run(e, k);
+        if (r.start < end || r.length == 0 || r.start > e.length || r.length > e.length - r.start)
+        {
+          return false;
+        }
+        end = r.start + r.length;
+      }
+    }
+    return true;
+  }
+
+public:
+  explicit Container(const std::string &path)
+  {
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+      printf("Cannot open file: %s\n", path.c_str());
+      exit(1);
+    }
+    if (!S_ISREG(info.st_mode))
+    {
+      printf("A genome container must be a regular file: %s\n", path.c_str());
+      exit(1);
+    }
+    m_size = info.st_size;
+    void *map = (m_size >= sizeof(Header)) ? mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    m_data = (map == MAP_FAILED) ? nullptr : static_cast<const unsigned char *>(map);
+    if (m_data == nullptr || memcmp(header().magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header().version != VERSION)
+    {
+      printf("Not a genome container (version %llu): %s\n",
+             static_cast<unsigned long long>(VERSION), path.c_str());
+      exit(1);
+    }
+    if (!valid())
+    {
+      printf("Truncated or corrupt genome container: %s\n", path.c_str());
+      exit(1);
+    }
+  }
+  ~Container() { munmap(const_cast<unsigned char *>(m_data), m_size); }
+  Container(const Container &) = delete;
+  Container &operator=(const Container &) = delete;
+
+  const Header &header() const { return *reinterpret_cast<const Header *>(m_data); }
+  size_t size() const { return header().record_num; }
+  size_t bytes() const { return m_size; }
+  const Entry &entry(size_t i) const
+  {
+    return reinterpret_cast<const Entry *>(m_data + header().index_offset)[i];
+  }
+  const Run &run(const Entry &entry, size_t k) const
+  {
+    return reinterpret_cast<const Run *>(m_data + header().runs_offset)[entry.run_first + k];
+  }
+  // the description line of a record
+  std::string name(const Entry &entry) const
+  {
+    return std::string(reinterpret_cast<const char *>(m_data + header().names_offset + entry.name_offset),
+                       entry.name_size);
+  }
+  // the packed bases of a record
+  const unsigned char *bases(const Entry &entry) const { return m_data + entry.bases_offset; }
+  // code 0-3 of base j of a record; masked bases read 0
+  unsigned code(const Entry &entry, size_t j) const
+  {
+    return (m_data[entry.bases_offset + j / 4] >> (2 * (j % 4))) & 3;
+  }
+};
+} // namespace genome